@@ -85,6 +85,21 @@ int main(void)
 		.SelectItemPadding = 3,
 		.SelectPageItems = 5,
 		.SelectPaddingX = 10,
+		.SelectScrollbarWidth = 8,
+		.SelectScrollbarColor = 0xAAAAAA,
+
+		/* Table */
+		.TableTextColor = 0x000000,
+		.TableRowColor = { 0xFFFFFF, 0xf5f5f5 },
+		.TableHeaderColor = 0xe1e1e1,
+		.TableHeaderTextColor = 0x000000,
+		.TableSelectedColor = 0xcce4ff,
+		.TableBorderColor = 0xadadad,
+		.TableBorderThickness = 1,
+		.TableRowHeight = 24,
+		.TablePaddingX = 6,
+		.TableScrollbarWidth = 8,
+		.TableScrollbarColor = 0xAAAAAA,
 	};
 
 	sg_theme = &theme;
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SIMPLEGUI_IMPLEMENTATION
+#include "../../simplegui.h"
+
+#define WINDOW_W 1280
+#define WINDOW_H 720
+
+int main(int argc, char **argv)
+{
+	int frames = (argc > 1) ? atoi(argv[1]) : 1000;
+	const char *golden = (argc > 2) ? argv[2] : "frame.bmp";
+
+	char buf[64] = "Hello world";
+	SgStringBuffer sb =
+	{
+		.buffer = buf,
+		.length = 11,
+		.capacity = sizeof(buf)
+	};
+
+	bool checked[16] = { 0 };
+	double values[8] = { 0 };
+
+	size_t cur = 0;
+	const char *items[] = { "Red", "Green", "Blue" };
+
+	sg_init_headless(sg_size(WINDOW_W, WINDOW_H));
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	for(int frame = 0; frame < frames && sg_running(); ++frame)
+	{
+		sg_begin();
+
+		for(int y = 0; y < 10; ++y)
+		{
+			for(int x = 0; x < 8; ++x)
+			{
+				char label[32];
+				snprintf(label, sizeof(label), "Button %d", y * 8 + x);
+				sg_button(sg_rect(10 + x * 150, 10 + y * 40, 140, 32), label);
+			}
+		}
+
+		for(int i = 0; i < 16; ++i)
+		{
+			sg_checkbox(sg_rect(10 + i * 40, 420, 22, 22), &checked[i]);
+		}
+
+		for(int i = 0; i < 8; ++i)
+		{
+			values[i] = (frame + i * 10) % 100;
+			sg_slider(sg_rect(10, 460 + i * 28, 400, 20), &values[i], 0.0, 100.0);
+		}
+
+		char counter[32];
+		snprintf(counter, sizeof(counter), "Frame %d", frame);
+		sg_label(sg_rect(450, 460, 0, 0), counter, 0);
+
+		sg_textbox(sg_rect(450, 500, 300, 32), &sb);
+		sg_select(sg_rect(450, 550, 200, 32), items, SG_ARRLEN(items), &cur);
+
+		sg_update();
+	}
+
+	uint64_t end = SDL_GetPerformanceCounter();
+	double seconds = (double)(end - start) / SDL_GetPerformanceFrequency();
+	printf("%d frames in %.3f s (%.1f frames/s, %.3f ms/frame)\n",
+		frames, seconds, frames / seconds, 1000.0 * seconds / frames);
+
+	if(sg_save_framebuffer(golden))
+	{
+		fprintf(stderr, "Failed to save framebuffer to \"%s\"\n", golden);
+	}
+
+	sg_destroy();
+	return 0;
+}
@@ -21,6 +21,8 @@ int main(void)
 
 	SgFontAtlas fontatlas = sg_font_atlas_create(MAX_CHAR_SIZE, FONT_SIZE);
 	sg_fontatlas_add_ascii(fontatlas, font);
+	/* 0xFF never occurs in UTF-8, so "\xFF" keeps meaning the euro sign
+		even if the glyph cache is enabled later */
 	sg_fontatlas_add_utf8(fontatlas, font, "€", 0xFF);
 	sg_fontatlas_add_default_icons(fontatlas);
 	sg_fontatlas_update(fontatlas);
@@ -76,6 +78,21 @@ int main(void)
 		.SelectItemPadding = 3,
 		.SelectPageItems = 5,
 		.SelectPaddingX = 10,
+		.SelectScrollbarWidth = 8,
+		.SelectScrollbarColor = 0xAAAAAA,
+
+		/* Table */
+		.TableTextColor = 0x000000,
+		.TableRowColor = { 0xFFFFFF, 0xf5f5f5 },
+		.TableHeaderColor = 0xe1e1e1,
+		.TableHeaderTextColor = 0x000000,
+		.TableSelectedColor = 0xcce4ff,
+		.TableBorderColor = 0xadadad,
+		.TableBorderThickness = 1,
+		.TableRowHeight = 24,
+		.TablePaddingX = 6,
+		.TableScrollbarWidth = 8,
+		.TableScrollbarColor = 0xAAAAAA,
 	};
 
 	sg_theme = &theme;
@@ -111,16 +128,16 @@ int main(void)
 	size_t appliance_sel = 0;
 
 	char buf_power[64];
-	SgStringBuffer sb_power = { buf_power, 0, sizeof(buf_power) };
+	SgStringBuffer sb_power = { .buffer = buf_power, .capacity = sizeof(buf_power) };
 
 	char buf_capacity[64];
-	SgStringBuffer sb_capacity = { buf_capacity, 0, sizeof(buf_capacity) };
+	SgStringBuffer sb_capacity = { .buffer = buf_capacity, .capacity = sizeof(buf_capacity) };
 
 	char buf_usage[64];
-	SgStringBuffer sb_usage = { buf_usage, 0, sizeof(buf_usage) };
+	SgStringBuffer sb_usage = { .buffer = buf_usage, .capacity = sizeof(buf_usage) };
 
 	char buf_price[64];
-	SgStringBuffer sb_price = { buf_price, 0, sizeof(buf_price) };
+	SgStringBuffer sb_price = { .buffer = buf_price, .capacity = sizeof(buf_price) };
 
 	int X0 = 10;
 	int X1 = 220;
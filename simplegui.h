@@ -26,6 +26,16 @@ static inline int sg_max(int a, int b)
 	return a > b ? a : b;
 }
 
+static inline size_t sg_min_size(size_t a, size_t b)
+{
+	return a < b ? a : b;
+}
+
+static inline size_t sg_max_size(size_t a, size_t b)
+{
+	return a > b ? a : b;
+}
+
 static inline double sg_fclamp(double x, double min, double max)
 {
 	if(x < min) { return min; }
@@ -297,13 +307,69 @@ SgFont sg_font_load(const char *file, int size);
 void sg_font_destroy(SgFont font);
 
 /* SgFontAtalas */
+
+/* Shelf of a glyph that did not fit, it is rendered again next frame */
+#define SG_GLYPH_RETRY -2
+
+/* Codepoints remembered as empty before they are all forgotten */
+#ifndef SG_GLYPH_EMPTY_MAX
+#define SG_GLYPH_EMPTY_MAX 1024
+#endif
+
+/* Glyph cache entry, codepoint 0 marks a free slot */
+typedef struct
+{
+	uint32_t Codepoint;
+	int Shelf;
+	SgRect Rect;
+} SgGlyph;
+
+typedef struct
+{
+	int X;
+	uint32_t LastUsed;
+} SgGlyphShelf;
+
+/* Changed areas kept apart until the next upload, more are merged */
+#ifndef SG_ATLAS_DIRTY_RECTS
+#define SG_ATLAS_DIRTY_RECTS 16
+#endif
+
 typedef struct
 {
 	int FontHeight;
 	int MaxCharSize;
-	SgSize CharDim[256];
-	SgSurface Surface;
+	SgRect White;
+	SgRect CharRect[256];
+	SgSize Size;
+	uint8_t *Pixels;
 	SgTexture Texture;
+	int ShelfX;
+	int ShelfY;
+	int ShelfHeight;
+	int UsedPixels;
+
+	/* Glyph cache */
+	SgFont Font;
+	int CacheTop;
+	int LineHeight;
+	int CacheShelfCount;
+	SgGlyphShelf *CacheShelves;
+	SgGlyph *Glyphs;
+	uint32_t GlyphCapacity;
+	uint32_t GlyphCount;
+	uint32_t EmptyCount;
+
+	/* Frame in which a glyph did not fit, see SG_GLYPH_RETRY */
+	uint32_t CacheFullFrame;
+
+	/* Areas not uploaded to Texture yet */
+	SgRect DirtyRects[SG_ATLAS_DIRTY_RECTS];
+	int DirtyCount;
+
+	/* File mapping Pixels points into, see sg_fontatlas_load */
+	void *Mapping;
+	size_t MappingSize;
 } SgFontAtlasInternal;
 
 typedef SgFontAtlasInternal *SgFontAtlas;
@@ -322,6 +388,10 @@ void sg_fontatlas_add_default_checkmark(SgFontAtlas atlas);
 void sg_fontatlas_add_default_select(SgFontAtlas atlas);
 void sg_fontatlas_add_default_icons(SgFontAtlas atlas);
 void sg_fontatlas_update(SgFontAtlas atlas);
+double sg_fontatlas_fill_ratio(SgFontAtlas atlas);
+int sg_fontatlas_enable_cache(SgFontAtlas atlas, SgFont font, int size);
+int sg_fontatlas_save(SgFontAtlas atlas, const char *file);
+SgFontAtlas sg_fontatlas_load(const char *file);
 
 /* font rendering */
 int sg_char_height(uint8_t c);
@@ -383,6 +453,7 @@ typedef struct
 	int TextboxPaddingX;
 	SgRect Cursor;
 	SgColor CursorColor;
+	int CursorBlinkMs;
 	SgColor SelectionColor;
 	SgColor SelectionTextColor;
 
@@ -405,9 +476,47 @@ typedef struct
 	int SelectItemPadding;
 	int SelectPageItems;
 	int SelectPaddingX;
+	int SelectScrollbarWidth;
+	SgColor SelectScrollbarColor;
+
+	/* Table */
+	SgColor TableTextColor;
+	SgColor TableRowColor[2];
+	SgColor TableHeaderColor;
+	SgColor TableHeaderTextColor;
+	SgColor TableSelectedColor;
+	SgColor TableBorderColor;
+	int TableBorderThickness;
+	int TableRowHeight;
+	int TablePaddingX;
+	int TableScrollbarWidth;
+	SgColor TableScrollbarColor;
 } SgTheme;
 
+enum
+{
+	SG_PRESENT_VSYNC,
+	SG_PRESENT_IMMEDIATE
+};
+
+typedef struct
+{
+	SgSize Size;
+	const char *Title;
+	bool Headless;
+	uint32_t WindowFlags;
+	uint32_t RendererFlags;
+	int PresentMode;
+	int TargetFps;
+} SgConfig;
+
+SgConfig sg_default_config(SgSize size, const char *title);
+void sg_init_ex(const SgConfig *config);
 void sg_init(SgSize size, const char *title);
+void sg_init_headless(SgSize size);
+void sg_set_target_fps(int fps);
+SgSurface sg_get_framebuffer(void);
+int sg_save_framebuffer(const char *file);
 void sg_destroy(void);
 void sg_set_title(const char *title);
 void sg_begin(void);
@@ -416,6 +525,15 @@ void sg_update(void);
 bool sg_running(void);
 SgSize sg_get_window_size(void);
 
+/* idle handling */
+void sg_set_event_driven(bool enabled);
+void sg_request_frame(uint32_t ms);
+void sg_wakeup(void);
+void sg_invalidate(void);
+
+/* dirty rectangles */
+void sg_set_dirty_rects(bool enabled);
+
 /* mouse handling */
 bool sg_is_mouse_button_down(int button);
 bool sg_is_mouse_button_pressed(int button);
@@ -440,12 +558,62 @@ int sg_key_to_codepoint_german(int k);
 
 extern int (*sg_key_to_codepoint)(int);
 
+/* render state */
+int sg_render_state_elided(void);
+
+/* frame statistics */
+typedef struct
+{
+	int DrawCalls;
+	int Glyphs;
+	int Rects;
+	int TextureBinds;
+	int StateChanges;
+	int StateElided;
+	int Events;
+	int Widgets;
+	double BeginMs;
+	double WidgetMs;
+	double UpdateMs;
+	double PresentMs;
+	double FrameMs;
+} SgFrameStats;
+
+const SgFrameStats *sg_get_frame_stats(void);
+
+/* debug hud */
+void sg_set_debug_hud(bool enabled);
+bool sg_get_debug_hud(void);
+
+/* profiling */
+void sg_set_profiling(bool enabled);
+void sg_zone_begin(const char *name);
+void sg_zone_end(void);
+int sg_trace_save(const char *file);
+
+/* draw layers */
+enum
+{
+	SG_LAYER_BASE,
+	SG_LAYER_OVERLAY,
+	SG_LAYER_COUNT
+};
+
+void sg_set_layer(int layer);
+
+/* clipping */
+void sg_push_clip(SgRect rect);
+void sg_pop_clip(void);
+
 /* draw and fill rect */
 void sg_fill_rect(SgRect rect, SgColor color);
 void sg_draw_rect(SgRect rect, int border, SgColor color);
 
 /* Controls */
 /* All Controls are styled based on the same global theme */
+void sg_widget_begin(void);
+void sg_widget_end(void);
+
 void sg_set_checkmark_char(uint8_t index);
 void sg_set_select_char(uint8_t index);
 
@@ -455,14 +623,104 @@ typedef struct
 	char *buffer;
 	size_t length;
 	size_t capacity;
+	size_t gap;
+	bool owned;
+	size_t version;
 } SgStringBuffer;
 
+void sg_string_buffer_init(SgStringBuffer *sb, const char *text);
+void sg_string_buffer_set(SgStringBuffer *sb, const char *text);
+const char *sg_string_buffer_cstr(SgStringBuffer *sb);
+void sg_string_buffer_touch(SgStringBuffer *sb);
+void sg_string_buffer_free(SgStringBuffer *sb);
+
 void sg_label(SgRect dimensions, const char *text, int flags);
 bool sg_button(SgRect dimensions, const char *text);
 bool sg_checkbox(SgRect dimensions, bool *checked);
 int sg_slider(SgRect dimensions, double *value, double min, double max);
 int sg_textbox(SgRect dimensions, SgStringBuffer *text);
 int sg_select(SgRect dimensions, const char *items[], size_t count, size_t *active);
+int sg_select_filter(SgRect dimensions, const char *items[], size_t count, size_t *active);
+
+typedef void (*SgSelectProvider)(size_t index, char *buf, size_t len, void *userdata);
+int sg_select_provider(SgRect dimensions, SgSelectProvider provider, void *userdata,
+	size_t count, size_t *active);
+
+/* Editor */
+typedef struct
+{
+	int Source;
+	size_t Start;
+	size_t Length;
+} SgPiece;
+
+/* Position and x offset of a character in a line */
+typedef struct
+{
+	size_t Line;
+	size_t Pos;
+	int X;
+} SgEditorAnchor;
+
+typedef struct
+{
+	char *Original;
+	char *Added;
+	size_t AddedLength;
+	size_t AddedCapacity;
+	SgPiece *Pieces;
+	size_t PieceCount;
+	size_t PieceCapacity;
+	size_t Length;
+	size_t *Lines;
+	size_t LineCount;
+	size_t LineCapacity;
+	size_t LineGap;
+	size_t CachePiece;
+	size_t CacheStart;
+	size_t Position;
+	size_t Selection;
+	int ScrollX;
+	size_t ScrollY;
+	uint32_t Version;
+
+	/* Where the last frame found the caret and the first visible
+		character of each line, so long lines are not walked again */
+	SgEditorAnchor Caret;
+	SgEditorAnchor *Anchors;
+	size_t AnchorCount;
+	SgFontAtlas AnchorAtlas;
+
+	/* Pixel column Up and Down return to, while the caret is
+		still where the last of them left it */
+	int PreferredX;
+	size_t PreferredPos;
+} SgEditor;
+
+void sg_editor_init(SgEditor *ed, const char *text, size_t length);
+void sg_editor_free(SgEditor *ed);
+size_t sg_editor_length(const SgEditor *ed);
+size_t sg_editor_line_count(const SgEditor *ed);
+size_t sg_editor_read(SgEditor *ed, size_t pos, char *buf, size_t len);
+int sg_editor(SgRect dimensions, SgEditor *ed);
+
+/* Table */
+typedef void (*SgTableCell)(size_t row, size_t column, char *buf, size_t len, void *userdata);
+
+typedef struct
+{
+	size_t RowCount;
+	size_t ColumnCount;
+	const int *ColumnWidths;
+	const char **Titles;
+	SgTableCell Cell;
+	void *UserData;
+	size_t ScrollRow;
+	int ScrollX;
+	size_t Selected;
+} SgTable;
+
+int sg_table(SgRect dimensions, SgTable *table);
 
 /* ========================================================================== */
 /* IMPLEMENTATION */
@@ -493,8 +751,14 @@ SgFontAtlas _sg_fontatlas_default = NULL;
 
 SDL_Window *_sg_window = NULL;
 SDL_Renderer *_sg_renderer = NULL;
+SgSurface _sg_framebuffer = NULL;
 SgFontAtlas _sg_fontatlas = NULL;
 
+/* Atlases with changes sg_update has to upload */
+static SgFontAtlas *_sg_dirty_atlases;
+static int _sg_dirty_atlas_count;
+static int _sg_dirty_atlas_capacity;
+
 bool _sg_running = false;
 
 SgPoint _sg_scroll;
@@ -522,1624 +786,6062 @@ bool sg_double_click;
 bool sg_triple_click;
 bool _sg_tb_multi_clicked = false;
 
+static int *_sg_tb_offsets;
+static int _sg_tb_offset_count;
+static int _sg_tb_offset_capacity;
+
+/* What the offset table was computed for */
+static SgStringBuffer *_sg_tb_measured;
+static size_t _sg_tb_measured_length;
+static size_t _sg_tb_measured_version;
+static SgFontAtlas _sg_tb_measured_atlas;
+
 static const char **_sg_select_items;
+static const char *(*_sg_select_text)(size_t row);
+static SgSelectProvider _sg_select_provider;
+static void *_sg_select_userdata;
+
+/* Longest item text of sg_select_provider */
+#ifndef SG_SELECT_TEXT_MAX
+#define SG_SELECT_TEXT_MAX 256
+#endif
+
+static char _sg_select_buf[SG_SELECT_TEXT_MAX];
 static size_t _sg_select_item_count;
 static size_t _sg_select_item_cur;
 static size_t _sg_select_item_start;
 static SgRect _sg_select_dim;
+static bool _sg_select_scrolling;
+static int _sg_select_grab;
+
+/* Items per frame that the substring search of sg_select_filter checks */
+#ifndef SG_FILTER_SCAN_STEP
+#define SG_FILTER_SCAN_STEP 65536
+#endif
+
+/* sg_select_filter keeps a case insensitive sorted index of the last item
+	array, prefix matches are a range of it. Substring matches that are
+	not prefix matches are collected in the background. */
+static const char **_sg_filter_items;
+static size_t _sg_filter_count;
+static size_t *_sg_filter_index;
+static size_t _sg_filter_lo;
+static size_t _sg_filter_hi;
+static size_t *_sg_filter_matches;
+static size_t _sg_filter_match_count;
+static size_t _sg_filter_match_capacity;
+static size_t _sg_filter_scan;
+static SgStringBuffer _sg_filter_query;
+static size_t _sg_filter_position;
+static size_t _sg_filter_selection;
+
+/* Area covered by the open dropdown in the last frame,
+	controls below it do not see the mouse */
+static SgRect _sg_overlay;
+static SgRect _sg_overlay_next;
+
+static SgColor _sg_clear_color;
+
+static bool _sg_event_driven = false;
+static bool _sg_frame_idle = false;
+static bool _sg_force_present = true;
+static int _sg_frame_events;
+static uint32_t _sg_frame_deadline;
+static uint64_t _sg_frame_period;
+static uint64_t _sg_frame_next;
+static uint32_t _sg_wakeup_event = (uint32_t)-1;
+
+static SgFrameStats _sg_stats;
+static SgFrameStats _sg_last_stats;
+static uint64_t _sg_time_widgets;
+static uint64_t _sg_time_frame;
 
 #define SG_FONTDEBUG 0
 
 /* ========================================================================== */
-/* font rendering */
-SgFont sg_font_load(const char *file, int size)
-{
-	return TTF_OpenFont(file, size);
-}
-
-void sg_font_destroy(SgFont font)
-{
-	TTF_CloseFont(font);
-}
+/* render state cache */
+#define SG_COLOR_INVALID 0xFFFFFFFF
 
-SgFontAtlas sg_font_atlas_create(int max_char_size, int font_height)
+typedef struct
 {
-	SgSurface surface = SDL_CreateRGBSurface(0,
-		max_char_size * 16, max_char_size * 16,
-		32, 0xff, 0xff00, 0xff0000, 0xff000000);
+	SgColor DrawColor;
+	SgTexture Texture;
+} SgRenderState;
 
-	SgFontAtlasInternal *atlas = sg_calloc(1, sizeof(SgFontAtlasInternal));
-	memset(atlas->CharDim, 0, sizeof(atlas->CharDim));
-	atlas->FontHeight = font_height;
-	atlas->MaxCharSize = max_char_size;
-	atlas->Surface = surface;
-	atlas->Texture = NULL;
-	return atlas;
-}
+static SgRenderState _sg_state;
 
-void sg_set_fontatlas(SgFontAtlas atlas)
+/* Forget the cached state, the next call of each kind goes to SDL */
+static void sg_state_invalidate(void)
 {
-	_sg_fontatlas = atlas;
+	_sg_state.DrawColor = SG_COLOR_INVALID;
+	_sg_state.Texture = NULL;
 }
 
-void sg_fontatlas_destroy(SgFontAtlas atlas)
+static void sg_set_color(SgColor color)
 {
-	SDL_FreeSurface(atlas->Surface);
-	if(atlas->Texture)
+	if(_sg_state.DrawColor == color)
 	{
-		sg_texture_destroy(atlas->Texture);
+		++_sg_stats.StateElided;
+		return;
 	}
 
-	sg_free(atlas);
+	++_sg_stats.StateChanges;
+	_sg_state.DrawColor = color;
+	SDL_SetRenderDrawColor(_sg_renderer,
+		sg_color_r(color), sg_color_g(color), sg_color_b(color), 255);
 }
 
-static uint32_t sg_get_pixel(SgSurface s, int x, int y)
+/* SDL has no explicit texture binding, but switching the texture between
+	two geometry calls is what costs the renderer a state change */
+static void sg_set_texture(SgTexture texture)
 {
-	uint32_t *pixels = s->pixels;
-	return pixels[y * (s->pitch / 4) + x];
+	if(_sg_state.Texture == texture)
+	{
+		return;
+	}
+
+	++_sg_stats.TextureBinds;
+	_sg_state.Texture = texture;
 }
 
-static void sg_set_pixel(SgSurface s, int x, int y, uint32_t color)
+int sg_render_state_elided(void)
 {
-	uint32_t *pixels = s->pixels;
-	pixels[y * (s->pitch / 4) + x] = color;
+	return _sg_last_stats.StateElided;
 }
 
-int sg_surface_color_to_binary(uint32_t color)
+/* ========================================================================== */
+/* frame statistics */
+static double sg_stats_ms(uint64_t from, uint64_t to)
 {
-	return (color >> 24) > 127;
+	return (double)(to - from) * 1000.0 / (double)SDL_GetPerformanceFrequency();
 }
 
-int sg_fontatlas_blit_surface(SgFontAtlas atlas, SgSurface s, SgRect src, uint8_t index)
+const SgFrameStats *sg_get_frame_stats(void)
 {
-	SgRect dst =
-	{
-		(index & 0x0F) * atlas->MaxCharSize,
-		(index >> 4) * atlas->MaxCharSize,
-		src.w,
-		src.h
-	};
-
-	if(SG_FONTDEBUG)
-	{
-		/* print c array */
-		if(isprint(index))
-		{
-			printf("\t/* Char %d ('%c') */\n", index, index);
-		}
-		else
-		{
-			printf("\t/* Char %d */\n", index);
-		}
-
-		for(int y = 0; y < src.h; ++y)
-		{
-			printf("\t");
-
-			int byte = 0;
-			int bit = 7;
-			for(int x = 0; x < src.w; ++x)
-			{
-				uint32_t color = sg_get_pixel(s, src.x + x, src.y + y);
-				if(sg_surface_color_to_binary(color))
-				{
-					byte |= (1 << bit);
-				}
+	return &_sg_last_stats;
+}
 
-				--bit;
-				if(bit < 0)
-				{
-					printf("0x%02X, ", byte);
-					bit = 7;
-					byte = 0;
-				}
-			}
+/* ========================================================================== */
+/* profiling */
+#ifndef SG_TRACE_CAPACITY
+#define SG_TRACE_CAPACITY (1 << 16)
+#endif
 
-			if((src.w & 3) != 0)
-			{
-				printf("0x%02X, ", byte);
-			}
+#define SG_ZONE_DEPTH 32
 
-			printf("/* ");
-			for(int x = 0; x < src.w; ++x)
-			{
-				uint32_t color = sg_get_pixel(s, src.x + x, src.y + y);
-				printf("%c", sg_surface_color_to_binary(color) ? '#' : ' ');
-			}
+typedef struct
+{
+	const char *Name;
+	uint64_t Start;
+	uint64_t End;
+	uint32_t Frame;
+} SgZone;
 
-			printf(" */\n");
-		}
+static SgZone *_sg_trace;
+static size_t _sg_trace_head;
+static size_t _sg_trace_count;
+static uint64_t _sg_trace_epoch;
+static uint32_t _sg_frame_number;
+static SgZone _sg_zone_stack[SG_ZONE_DEPTH];
+static int _sg_zone_depth;
 
-		printf("\n");
+void sg_set_profiling(bool enabled)
+{
+	if(enabled && !_sg_trace)
+	{
+		_sg_trace = sg_malloc(SG_TRACE_CAPACITY * sizeof(*_sg_trace));
+		_sg_trace_epoch = SDL_GetPerformanceCounter();
+	}
+	else if(!enabled && _sg_trace)
+	{
+		sg_free(_sg_trace);
+		_sg_trace = NULL;
 	}
 
-	atlas->CharDim[index] = sg_size(src.w, src.h);
-	return SDL_BlitSurface(s, &src, atlas->Surface, &dst);
+	_sg_trace_head = 0;
+	_sg_trace_count = 0;
+	_sg_zone_depth = 0;
 }
 
-int sg_fontatlas_add_char(SgFontAtlas atlas, SgFont font, uint8_t c)
+/* Names are stored as pointers and must outlive the trace */
+void sg_zone_begin(const char *name)
 {
-	SDL_Color color = { 255, 255, 255, 0 };
-	char letter[2] = { c, '\0' };
-	SDL_Surface *s = TTF_RenderText_Blended(font, letter, color);
-	SDL_SetSurfaceBlendMode(s, SDL_BLENDMODE_NONE);
-	int status = sg_fontatlas_blit_surface(atlas, s, sg_rect(0, 0, s->w, s->h), c);
-	SDL_FreeSurface(s);
-	return status;
-}
+	if(!_sg_trace)
+	{
+		return;
+	}
 
-int sg_fontatlas_add_ascii(SgFontAtlas atlas, SgFont font)
-{
-	int status = 0;
-	for(int i = 32; i <= 126; ++i)
+	if(_sg_zone_depth < SG_ZONE_DEPTH)
 	{
-		if(sg_fontatlas_add_char(atlas, font, i))
-		{
-			status = 1;
-		}
+		SgZone *zone = &_sg_zone_stack[_sg_zone_depth];
+		zone->Name = name;
+		zone->Start = SDL_GetPerformanceCounter();
+		zone->Frame = _sg_frame_number;
 	}
 
-	return status;
+	++_sg_zone_depth;
 }
 
-int sg_fontatlas_add_utf8(SgFontAtlas atlas, SgFont font, const char *utf8, uint8_t index)
+void sg_zone_end(void)
 {
-	SDL_Color color = { 255, 255, 255, 0 };
-	SDL_Surface *s = TTF_RenderUTF8_Blended(font, utf8, color);
-	int status = sg_fontatlas_blit_surface(atlas, s, sg_rect(0, 0, s->w, s->h), index);
-	SDL_FreeSurface(s);
-	return status;
-}
+	if(!_sg_trace || !_sg_zone_depth)
+	{
+		return;
+	}
 
-int sg_fontatlas_add_icon(SgFontAtlas atlas, const char *file, uint8_t index)
-{
-	SDL_Surface *s = IMG_Load(file);
-	if(!s)
+	if(--_sg_zone_depth >= SG_ZONE_DEPTH)
 	{
-		return 1;
+		return;
 	}
 
-	return sg_fontatlas_blit_surface(atlas, s, sg_rect(0, 0, s->w, s->h), index);
+	SgZone *zone = &_sg_trace[_sg_trace_head];
+	*zone = _sg_zone_stack[_sg_zone_depth];
+	zone->End = SDL_GetPerformanceCounter();
+	_sg_trace_head = (_sg_trace_head + 1) % SG_TRACE_CAPACITY;
+	if(_sg_trace_count < SG_TRACE_CAPACITY)
+	{
+		++_sg_trace_count;
+	}
 }
 
-void sg_fontatlas_add_binary(SgFontAtlas atlas, const uint8_t *bytes, SgSize size, uint8_t index)
+static void sg_trace_write_string(FILE *fp, const char *s)
 {
-	int i = 0;
-	for(int y = 0; y < size.h; ++y)
+	fputc('"', fp);
+	for(; *s; ++s)
 	{
-		int byte = bytes[i];
-		int bit = 7;
-		for(int x = 0; x < size.w; ++x)
+		if(*s == '"' || *s == '\\')
 		{
-			if(byte & (1 << bit))
-			{
-				sg_set_pixel(atlas->Surface,
-					(index & 0x0F) * atlas->MaxCharSize + x,
-					(index >> 4) * atlas->MaxCharSize + y, 0xFFFFFFFF);
-			}
+			fputc('\\', fp);
+		}
 
-			--bit;
-			if(bit < 0)
-			{
-				bit = 7;
-				++i;
-				byte = bytes[i];
-			}
+		if((uint8_t)*s >= ' ')
+		{
+			fputc(*s, fp);
 		}
 	}
 
-	atlas->CharDim[index] = size;
-}
-
-void sg_fontatlas_add_default_checkmark(SgFontAtlas atlas)
-{
-	sg_fontatlas_add_binary(atlas,
-		_sg_default_checkmark,
-		sg_size(16, 16), _sg_char_checkmark);
-}
-
-void sg_fontatlas_add_default_select(SgFontAtlas atlas)
-{
-	sg_fontatlas_add_binary(atlas,
-		_sg_default_select,
-		sg_size(16, 16), _sg_char_select);
+	fputc('"', fp);
 }
 
-void sg_fontatlas_add_default_icons(SgFontAtlas atlas)
+int sg_trace_save(const char *file)
 {
-	sg_fontatlas_add_default_checkmark(atlas);
-	sg_fontatlas_add_default_select(atlas);
-}
+	if(!_sg_trace)
+	{
+		return 1;
+	}
 
-void sg_fontatlas_update(SgFontAtlas atlas)
-{
-	if(SG_FONTDEBUG)
+	FILE *fp = fopen(file, "w");
+	if(!fp)
 	{
-		SDL_SaveBMP(atlas->Surface, "fontatlas.bmp");
+		return 1;
 	}
 
-	if(atlas->Texture)
+	double us = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+	size_t first = (_sg_trace_head + SG_TRACE_CAPACITY - _sg_trace_count) %
+		SG_TRACE_CAPACITY;
+
+	fputs("{\"traceEvents\":[\n", fp);
+	for(size_t i = 0; i < _sg_trace_count; ++i)
 	{
-		sg_texture_destroy(atlas->Texture);
+		const SgZone *zone = &_sg_trace[(first + i) % SG_TRACE_CAPACITY];
+		fputs("{\"name\":", fp);
+		sg_trace_write_string(fp, zone->Name);
+		fprintf(fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+			"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}%s\n",
+			(double)(zone->Start - _sg_trace_epoch) * us,
+			(double)(zone->End - zone->Start) * us,
+			zone->Frame, (i + 1 < _sg_trace_count) ? "," : "");
 	}
 
-	atlas->Texture = SDL_CreateTextureFromSurface(_sg_renderer, atlas->Surface);
+	fputs("],\"displayTimeUnit\":\"ms\"}\n", fp);
+	return fclose(fp) ? 1 : 0;
 }
 
-int sg_render_char(SgPoint p, uint8_t c, SgColor color)
+/* ========================================================================== */
+/* draw commands */
+enum
 {
-	int stride = _sg_fontatlas->MaxCharSize;
-	SgSize size = _sg_fontatlas->CharDim[c];
-	SDL_Rect src = { (c & 0x0F) * stride, (c >> 4) * stride, size.w, size.h };
-	SDL_Rect dst = { p.x, p.y, size.w, size.h };
-	SDL_SetTextureColorMod(_sg_fontatlas->Texture,
-		sg_color_r(color), sg_color_g(color), sg_color_b(color));
-	SDL_RenderCopy(_sg_renderer, _sg_fontatlas->Texture, &src, &dst);
-	return size.w;
-}
+	SG_CMD_NONE,
+	SG_CMD_RECT,
+	SG_CMD_QUAD
+};
 
-int sg_render_char_align(SgPoint p, uint8_t c, int flags, SgColor color)
+typedef struct
 {
-	int valign = flags & SG_VALIGN_MASK;
-	int halign = flags & SG_HALIGN_MASK;
-
-	if(halign == SG_HALIGN_CENTER)
-	{
-		p.x -= sg_char_width(c) / 2;
-	}
-	else if(halign == SG_HALIGN_RIGHT)
-	{
-		p.x -= sg_char_width(c);
-	}
+	int Type;
+	SgColor Color;
+	SgTexture Texture;
+	SgRect Src;
+	SgRect Dst;
+} SgCommand;
 
-	if(valign == SG_VALIGN_CENTER)
-	{
-		p.y -= sg_char_height(c) / 2;
-	}
-	else if(valign == SG_VALIGN_BOTTOM)
-	{
-		p.y -= sg_char_height(c);
-	}
+typedef struct
+{
+	SgCommand *Commands;
+	int Count;
+	int Capacity;
+} SgCommandList;
 
-	return sg_render_char(p, c, color);
-}
+/* Consecutive commands of one widget (or of loose drawing calls
+	between widgets), used to find the parts of a frame that changed */
+typedef struct
+{
+	int Layer;
+	int First;
+	int Count;
+} SgCommandGroup;
 
-int sg_render_char_in_rect(SgRect d, uint8_t c, int flags, SgColor color)
+typedef struct
 {
-	int valign = flags & SG_VALIGN_MASK;
-	int halign = flags & SG_HALIGN_MASK;
+	SgCommandGroup *Groups;
+	int Count;
+	int Capacity;
+} SgGroupList;
 
-	SgPoint r = { d.x, d.y };
-	if(halign == SG_HALIGN_CENTER)
-	{
-		r.x += d.w / 2 - sg_char_width(c) / 2;
-	}
-	else if(halign == SG_HALIGN_RIGHT)
-	{
-		r.x += d.w - sg_char_width(c);
-	}
+static SgCommandList _sg_layers[SG_LAYER_COUNT];
+static SgCommandList _sg_prev_layers[SG_LAYER_COUNT];
+static SgCommandList _sg_hud_commands;
+static SgColor _sg_prev_clear_color = SG_COLOR_INVALID;
+static int _sg_layer = SG_LAYER_BASE;
 
-	if(valign == SG_VALIGN_CENTER)
-	{
-		r.y += d.h / 2 - sg_char_height(c) / 2;
-	}
-	else if(valign == SG_VALIGN_BOTTOM)
-	{
-		r.y += d.h - sg_char_height(c);
-	}
+static SgGroupList _sg_groups;
+static SgGroupList _sg_prev_groups;
+static int _sg_group_current = -1;
 
-	return sg_render_char(r, c, color);
+#define SG_MAX_DAMAGE 16
+
+static bool _sg_dirty_rects = false;
+static SgTexture _sg_target;
+static SgSize _sg_target_size;
+static SgRect _sg_damage[SG_MAX_DAMAGE];
+
+/* Texture areas replaced in place since the last frame. Commands that
+	sample them are redrawn even if they did not change. */
+#define SG_MAX_UPLOADS 32
+
+typedef struct
+{
+	SgTexture Texture;
+	SgRect Rect;
+} SgUpload;
+
+static SgUpload _sg_uploads[SG_MAX_UPLOADS];
+static int _sg_upload_count;
+
+static SDL_Vertex *_sg_batch_vertices;
+static int *_sg_batch_indices;
+static int _sg_batch_count;
+static int _sg_batch_capacity;
+static SgTexture _sg_batch_texture;
+static float _sg_batch_texture_w;
+static float _sg_batch_texture_h;
+
+static SDL_Rect *_sg_rects;
+static int _sg_rect_capacity;
+
+void sg_set_layer(int layer)
+{
+	assert(layer >= 0 && layer < SG_LAYER_COUNT);
+	_sg_layer = layer;
 }
 
-int sg_render_string(SgPoint p, const char *s, SgColor color)
+/* ========================================================================== */
+/* clipping */
+#define SG_CLIP_DEPTH 16
+
+static SgRect _sg_clip_stack[SG_CLIP_DEPTH];
+static int _sg_clip_depth;
+
+void sg_push_clip(SgRect rect)
 {
-	int w = 0;
-	for(uint8_t c; (c = *s); ++s)
+	assert(_sg_clip_depth < SG_CLIP_DEPTH);
+	if(_sg_clip_depth > 0 &&
+		!SDL_IntersectRect(&rect, &_sg_clip_stack[_sg_clip_depth - 1], &rect))
 	{
-		w += sg_render_char(sg_point(p.x + w, p.y), c, color);
+		rect.w = 0;
+		rect.h = 0;
 	}
 
-	return w;
+	_sg_clip_stack[_sg_clip_depth++] = rect;
 }
 
-int sg_render_string_align(SgPoint p, const char *s, int flags, SgColor color)
+void sg_pop_clip(void)
 {
-	int valign = flags & SG_VALIGN_MASK;
-	int halign = flags & SG_HALIGN_MASK;
+	assert(_sg_clip_depth > 0);
+	--_sg_clip_depth;
+}
 
-	if(halign == SG_HALIGN_CENTER)
-	{
-		p.x -= sg_string_width(s) / 2;
-	}
-	else if(halign == SG_HALIGN_RIGHT)
+/* Clipping happens while recording, so clipped commands still batch.
+	Cuts dst to the clip rectangle and src by the same fraction,
+	returns false when nothing is left */
+static bool sg_clip(SgRect *src, SgRect *dst)
+{
+	if(!_sg_clip_depth)
 	{
-		p.x -= sg_string_width(s);
+		return true;
 	}
 
-	if(valign == SG_VALIGN_CENTER)
+	SgRect r;
+	if(!SDL_IntersectRect(dst, &_sg_clip_stack[_sg_clip_depth - 1], &r))
 	{
-		p.y -= _sg_fontatlas->FontHeight / 2;
+		return false;
 	}
-	else if(valign == SG_VALIGN_BOTTOM)
+
+	if(src)
 	{
-		p.y -= _sg_fontatlas->FontHeight;
+		int x0 = (r.x - dst->x) * src->w / dst->w;
+		int x1 = (r.x + r.w - dst->x) * src->w / dst->w;
+		int y0 = (r.y - dst->y) * src->h / dst->h;
+		int y1 = (r.y + r.h - dst->y) * src->h / dst->h;
+		src->x += x0;
+		src->y += y0;
+		src->w = sg_max(x1 - x0, 1);
+		src->h = sg_max(y1 - y0, 1);
 	}
 
-	return sg_render_string(p, s, color);
+	*dst = r;
+	return true;
 }
 
-int sg_render_string_in_rect(SgRect d, const char *s, int flags, SgColor color)
+static SgCommand *sg_command_push(int type)
 {
-	int valign = flags & SG_VALIGN_MASK;
-	int halign = flags & SG_HALIGN_MASK;
-
-	SgPoint r = { d.x, d.y };
-	if(halign == SG_HALIGN_CENTER)
-	{
-		r.x += d.w / 2 - sg_string_width(s) / 2;
-	}
-	else if(halign == SG_HALIGN_RIGHT)
+	SgCommandList *list = &_sg_layers[_sg_layer];
+	if(list->Count == list->Capacity)
 	{
-		r.x += d.w - sg_string_width(s);
+		list->Capacity = list->Capacity ? 2 * list->Capacity : 1024;
+		list->Commands = sg_realloc(list->Commands,
+			list->Capacity * sizeof(SgCommand));
 	}
 
-	if(valign == SG_VALIGN_CENTER)
+	SgCommandGroup *group = NULL;
+	if(_sg_group_current >= 0)
 	{
-		r.y += d.h / 2 - _sg_fontatlas->FontHeight / 2;
+		group = &_sg_groups.Groups[_sg_group_current];
+		if(group->Layer != _sg_layer)
+		{
+			group = NULL;
+		}
 	}
-	else if(valign == SG_VALIGN_BOTTOM)
+
+	if(!group)
 	{
-		r.y += d.h - _sg_fontatlas->FontHeight;
+		if(_sg_groups.Count == _sg_groups.Capacity)
+		{
+			_sg_groups.Capacity = _sg_groups.Capacity ? 2 * _sg_groups.Capacity : 256;
+			_sg_groups.Groups = sg_realloc(_sg_groups.Groups,
+				_sg_groups.Capacity * sizeof(SgCommandGroup));
+		}
+
+		_sg_group_current = _sg_groups.Count++;
+		group = &_sg_groups.Groups[_sg_group_current];
+		group->Layer = _sg_layer;
+		group->First = list->Count;
+		group->Count = 0;
 	}
 
-	return sg_render_string(r, s, color);
+	++group->Count;
+
+	/* Cleared completely, frames are compared with memcmp */
+	SgCommand *cmd = &list->Commands[list->Count++];
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->Type = type;
+	return cmd;
 }
 
-int sg_render_string_len(SgPoint p, const char *s, size_t len, SgColor color)
+/* Everything a widget draws between these calls forms one group */
+void sg_widget_begin(void)
 {
-	int w = 0;
-	size_t i = 0;
-	for(uint8_t c; (c = s[i]) && i < len; ++i)
-	{
-		w += sg_render_char(sg_point(p.x + w, p.y), c, color);
-	}
-
-	return w;
+	++_sg_stats.Widgets;
+	_sg_group_current = -1;
 }
 
-int sg_char_width(uint8_t c)
+void sg_widget_end(void)
 {
-	return _sg_fontatlas->CharDim[c].w;
+	_sg_group_current = -1;
 }
 
-int sg_char_height(uint8_t c)
+static void sg_commands_reset(void)
 {
-	return _sg_fontatlas->CharDim[c].h;
+	for(int i = 0; i < SG_LAYER_COUNT; ++i)
+	{
+		_sg_layers[i].Count = 0;
+	}
+
+	_sg_layer = SG_LAYER_BASE;
+	_sg_groups.Count = 0;
+	_sg_group_current = -1;
+	_sg_hud_commands.Count = 0;
 }
 
-int sg_string_width(const char *s)
+/* Recorded commands still reference textures until the end of the frame,
+	so a texture that is replaced or destroyed mid-frame has to be patched
+	out of the command buffer. Passing NULL drops the commands. */
+static void sg_list_retarget(SgCommandList *list,
+	SgTexture old_texture, SgTexture new_texture)
 {
-	int w = 0;
-	for(uint8_t c; (c = *s); ++s)
+	for(int j = 0; j < list->Count; ++j)
 	{
-		w += sg_char_width(c);
+		SgCommand *cmd = &list->Commands[j];
+		if(cmd->Type == SG_CMD_QUAD && cmd->Texture == old_texture)
+		{
+			cmd->Texture = new_texture;
+			if(!new_texture)
+			{
+				cmd->Type = SG_CMD_NONE;
+			}
+		}
 	}
-
-	return w;
 }
 
-int sg_string_width_len(const char *s, size_t len)
+static void sg_commands_retarget(SgTexture old_texture, SgTexture new_texture)
 {
-	int w = 0;
-	size_t i = 0;
-	for(uint8_t c; (c = s[i]) && i < len; ++i)
+	for(int i = 0; i < SG_LAYER_COUNT; ++i)
 	{
-		w += sg_char_width(c);
+		sg_list_retarget(&_sg_layers[i], old_texture, new_texture);
 	}
 
-	return w;
+	sg_list_retarget(&_sg_hud_commands, old_texture, new_texture);
 }
 
-/* ========================================================================== */
-/* allocation utils */
-static size_t _sg_alloc_count, _sg_free_count;
-
-void *sg_malloc(size_t size)
+static void sg_upload_add(SgTexture texture, SgRect r)
 {
-	void *p = malloc(size);
-	if(!p)
+	if(_sg_upload_count == SG_MAX_UPLOADS)
 	{
-		fprintf(stderr, "[sg_malloc] Memory allocation failed (%zu bytes)\n", size);
-		exit(1);
+		_sg_force_present = true;
+		return;
 	}
 
-	++_sg_alloc_count;
-	return p;
+	_sg_uploads[_sg_upload_count].Texture = texture;
+	_sg_uploads[_sg_upload_count].Rect = r;
+	++_sg_upload_count;
 }
 
-void *sg_calloc(size_t count, size_t size)
+/* Returns true if one of the commands samples an uploaded area */
+static bool sg_commands_stale(const SgCommand *cmd, int count)
 {
-	void *ptr = calloc(count, size);
-	if(!ptr)
+	for(int i = 0; i < _sg_upload_count; ++i)
 	{
-		fprintf(stderr, "[sg_calloc] Memory allocation failed (%zu * %zu bytes)", count, size);
-		exit(1);
+		const SgUpload *upload = &_sg_uploads[i];
+		for(int j = 0; j < count; ++j)
+		{
+			if(cmd[j].Type == SG_CMD_QUAD && cmd[j].Texture == upload->Texture &&
+				SDL_HasIntersection(&cmd[j].Src, &upload->Rect))
+			{
+				return true;
+			}
+		}
 	}
 
-	++_sg_alloc_count;
-	return ptr;
+	return false;
 }
 
-void *sg_realloc(void *p, size_t size)
+/* Returns true if the recorded frame is the same as the previous one */
+static bool sg_commands_unchanged(void)
 {
-	if(!p)
+	if(_sg_clear_color != _sg_prev_clear_color)
 	{
-		++_sg_alloc_count;
+		return false;
 	}
 
-	p = realloc(p, size);
-	if(!p)
+	for(int i = 0; i < SG_LAYER_COUNT; ++i)
 	{
-		fprintf(stderr, "[sg_realloc] Memory allocation failed (%zu bytes)", size);
-		exit(1);
+		SgCommandList *cur = &_sg_layers[i];
+		SgCommandList *prev = &_sg_prev_layers[i];
+		if(cur->Count != prev->Count || (cur->Count &&
+			memcmp(cur->Commands, prev->Commands, cur->Count * sizeof(SgCommand))) ||
+			sg_commands_stale(cur->Commands, cur->Count))
+		{
+			return false;
+		}
 	}
 
-	return p;
+	return true;
 }
 
-void sg_free(void *p)
+/* Keeps the submitted frame for comparison, the buffers of the frame
+	before it are reused for recording the next one */
+static void sg_commands_swap(void)
 {
-	if(p)
+	for(int i = 0; i < SG_LAYER_COUNT; ++i)
 	{
-		free(p);
-		++_sg_free_count;
+		SgCommandList tmp = _sg_prev_layers[i];
+		_sg_prev_layers[i] = _sg_layers[i];
+		_sg_layers[i] = tmp;
 	}
-}
 
-void sg_alloc_report(void)
-{
-	printf("%zu allocs, %zu frees\n", _sg_alloc_count, _sg_free_count);
+	SgGroupList tmp = _sg_prev_groups;
+	_sg_prev_groups = _sg_groups;
+	_sg_groups = tmp;
+
+	_sg_prev_clear_color = _sg_clear_color;
 }
 
-/* ========================================================================== */
-/* window */
-void sg_destroy(void)
+static void sg_commands_free(void)
 {
-	if(_sg_renderer)
+	for(int i = 0; i < SG_LAYER_COUNT; ++i)
 	{
-		SDL_DestroyRenderer(_sg_renderer);
-		_sg_renderer = NULL;
+		sg_free(_sg_layers[i].Commands);
+		_sg_layers[i].Commands = NULL;
+		_sg_layers[i].Count = 0;
+		_sg_layers[i].Capacity = 0;
+
+		sg_free(_sg_prev_layers[i].Commands);
+		_sg_prev_layers[i].Commands = NULL;
+		_sg_prev_layers[i].Count = 0;
+		_sg_prev_layers[i].Capacity = 0;
 	}
 
-	if(_sg_window)
-	{
-		SDL_DestroyWindow(_sg_window);
-		_sg_window = NULL;
-	}
+	sg_free(_sg_hud_commands.Commands);
+	memset(&_sg_hud_commands, 0, sizeof(_sg_hud_commands));
 
-	if(SDL_WasInit(SDL_INIT_VIDEO))
-	{
-		SDL_Quit();
-	}
+	sg_free(_sg_groups.Groups);
+	sg_free(_sg_prev_groups.Groups);
+	memset(&_sg_groups, 0, sizeof(_sg_groups));
+	memset(&_sg_prev_groups, 0, sizeof(_sg_prev_groups));
 
-	if(TTF_WasInit())
+	if(_sg_target)
 	{
-		TTF_Quit();
+		SDL_DestroyTexture(_sg_target);
+		_sg_target = NULL;
 	}
 
-	sg_fontatlas_destroy(_sg_fontatlas_default);
+	sg_free(_sg_batch_vertices);
+	sg_free(_sg_batch_indices);
+	_sg_batch_vertices = NULL;
+	_sg_batch_indices = NULL;
+	_sg_batch_capacity = 0;
+	_sg_batch_count = 0;
 
-	sg_free(_sg_key_pressed);
-	sg_free(_sg_key_released);
+	sg_free(_sg_rects);
+	_sg_rects = NULL;
+	_sg_rect_capacity = 0;
 }
 
-void sg_init(SgSize size, const char *title)
+static void sg_batch_reserve(int count)
 {
-	if(SDL_Init(SDL_INIT_VIDEO) < 0)
+	if(count <= _sg_batch_capacity)
 	{
-		fprintf(stderr, "Error initializing SDL; SDL_Init: %s\n", SDL_GetError());
-		sg_destroy();
-		exit(1);
+		return;
 	}
 
-	if(!(_sg_window = SDL_CreateWindow(title,
-		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-		size.w, size.h, SDL_WINDOW_RESIZABLE)))
+	int capacity = _sg_batch_capacity ? _sg_batch_capacity : 256;
+	while(capacity < count)
 	{
-		fprintf(stderr, "Error creating SDL_Window: %s\n", SDL_GetError());
-		sg_destroy();
-		exit(1);
+		capacity *= 2;
 	}
 
-	if(!(_sg_renderer = SDL_CreateRenderer(_sg_window, -1,
-		SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_ACCELERATED)))
-	{
-		fprintf(stderr, "Error creating SDL_Renderer: %s\n", SDL_GetError());
-		sg_destroy();
-		exit(1);
-	}
+	_sg_batch_vertices = sg_realloc(_sg_batch_vertices, 4 * capacity * sizeof(SDL_Vertex));
+	_sg_batch_indices = sg_realloc(_sg_batch_indices, 6 * capacity * sizeof(int));
 
-	if(TTF_Init())
+	/* Every quad uses the same two triangles, so the index buffer
+		only has to be filled in once for each new quad slot */
+	for(int i = _sg_batch_capacity; i < capacity; ++i)
 	{
-		printf("Loading initializing TTF: %s\n", TTF_GetError());
-		sg_destroy();
-		exit(1);
+		int *idx = _sg_batch_indices + 6 * i;
+		int v = 4 * i;
+		idx[0] = v;
+		idx[1] = v + 1;
+		idx[2] = v + 2;
+		idx[3] = v + 2;
+		idx[4] = v + 3;
+		idx[5] = v;
 	}
 
-	SDL_SetRenderDrawBlendMode(_sg_renderer, SDL_BLENDMODE_NONE);
-
-	_sg_key_state = SDL_GetKeyboardState(&_sg_num_keys);
-	_sg_key_pressed = sg_calloc(_sg_num_keys, 1);
-	_sg_key_released = sg_calloc(_sg_num_keys, 1);
-
-	_sg_running = true;
+	_sg_batch_capacity = capacity;
+}
 
-	_sg_fontatlas_default = sg_font_atlas_create(32, 16);
-	for(int c = 32; c <= 126; ++c)
+static void sg_batch_begin(SgTexture texture, int count)
+{
+	sg_set_texture(texture);
+	_sg_batch_texture = texture;
+	_sg_batch_count = 0;
+	sg_batch_reserve(count);
+	if(texture)
 	{
-		sg_fontatlas_add_binary(_sg_fontatlas_default,
-			_sg_default_font + (c - 32) * 18,
-			sg_size(8, 18), c);
+		int w, h;
+		SDL_QueryTexture(texture, NULL, NULL, &w, &h);
+		_sg_batch_texture_w = w;
+		_sg_batch_texture_h = h;
+	}
+	else
+	{
+		/* Texture coordinates are ignored without texture */
+		_sg_batch_texture_w = 1.0f;
+		_sg_batch_texture_h = 1.0f;
 	}
-
-	sg_fontatlas_add_default_icons(_sg_fontatlas_default);
-	sg_fontatlas_update(_sg_fontatlas_default);
-	_sg_fontatlas = _sg_fontatlas_default;
 }
 
-void sg_set_title(const char *title)
-{
-	SDL_SetWindowTitle(_sg_window, title);
+static void sg_batch_quad(SgRect src, SgRect dst, SgColor color)
+{
+	SDL_Color c = { sg_color_r(color), sg_color_g(color), sg_color_b(color), 255 };
+	float u0 = src.x / _sg_batch_texture_w;
+	float v0 = src.y / _sg_batch_texture_h;
+	float u1 = (src.x + src.w) / _sg_batch_texture_w;
+	float v1 = (src.y + src.h) / _sg_batch_texture_h;
+	float x0 = dst.x;
+	float y0 = dst.y;
+	float x1 = dst.x + dst.w;
+	float y1 = dst.y + dst.h;
+
+	SDL_Vertex *v = _sg_batch_vertices + 4 * _sg_batch_count;
+	v[0] = (SDL_Vertex) { { x0, y0 }, c, { u0, v0 } };
+	v[1] = (SDL_Vertex) { { x1, y0 }, c, { u1, v0 } };
+	v[2] = (SDL_Vertex) { { x1, y1 }, c, { u1, v1 } };
+	v[3] = (SDL_Vertex) { { x0, y1 }, c, { u0, v1 } };
+	++_sg_batch_count;
 }
 
-static void sg_set_color(SgColor color)
+static void sg_batch_end(void)
 {
-	SDL_SetRenderDrawColor(_sg_renderer,
-		sg_color_r(color), sg_color_g(color), sg_color_b(color), 255);
-}
+	if(!_sg_batch_count)
+	{
+		return;
+	}
 
-SgSize sg_get_window_size(void)
-{
-	SgSize size;
-	SDL_GetWindowSize(_sg_window, &size.w, &size.h);
-	return size;
-}
+	++_sg_stats.DrawCalls;
+	SDL_RenderGeometry(_sg_renderer, _sg_batch_texture,
+		_sg_batch_vertices, 4 * _sg_batch_count,
+		_sg_batch_indices, 6 * _sg_batch_count);
 
-/* ========================================================================== */
-/* draw and fill rectangle */
-void sg_fill_rect(SgRect rect, SgColor color)
-{
-	sg_set_color(color);
-	SDL_RenderFillRect(_sg_renderer, &rect);
+	_sg_batch_count = 0;
 }
 
-void sg_draw_rect(SgRect rect, int border, SgColor color)
+static bool sg_command_visible(const SgCommand *cmd, const SgRect *clip)
 {
-	sg_fill_rect(sg_rect(rect.x, rect.y, rect.w, border), color);
-	sg_fill_rect(sg_rect(rect.x, rect.y + rect.h - border, rect.w, border), color);
-
-	sg_fill_rect(sg_rect(rect.x, rect.y + border, border, rect.h - 2 * border), color);
-	sg_fill_rect(sg_rect(rect.x + rect.w - border, rect.y + border, border, rect.h - 2 * border), color);
+	return cmd->Type != SG_CMD_NONE &&
+		(!clip || SDL_HasIntersection(&cmd->Dst, clip));
 }
 
-/* ========================================================================== */
-/* textures */
-SgTexture sg_texture_load(const char *file)
+static void sg_flush_rects(const SgCommand *cmd, const SgCommand *end, const SgRect *clip)
 {
-	return IMG_LoadTexture(_sg_renderer, file);
-}
+	bool same_color = true;
+	int count = 0;
+	const SgCommand *first = NULL;
+	for(const SgCommand *c = cmd; c < end; ++c)
+	{
+		if(sg_command_visible(c, clip))
+		{
+			if(!first)
+			{
+				first = c;
+			}
 
-void sg_texture_destroy(SgTexture texture)
-{
-	SDL_DestroyTexture(texture);
-}
+			same_color = same_color && c->Color == first->Color;
+			++count;
+		}
+	}
 
-SgSize sg_texture_size(SgTexture texture)
-{
-	SgSize size;
-	SDL_QueryTexture(texture, NULL, NULL, &size.w, &size.h);
-	return size;
-}
+	if(!count)
+	{
+		return;
+	}
 
-SgRect sg_texture_bounds(SgTexture texture)
-{
-	SgSize size = sg_texture_size(texture);
-	return sg_rect(0, 0, size.w, size.h);
-}
+	if(same_color)
+	{
+		/* Single color: plain SDL_RenderFillRects */
+		if(count > _sg_rect_capacity)
+		{
+			_sg_rect_capacity = sg_max(2 * _sg_rect_capacity, count);
+			_sg_rects = sg_realloc(_sg_rects, _sg_rect_capacity * sizeof(SDL_Rect));
+		}
 
-void sg_texture_draw(SgTexture texture, SgRect src, SgRect dst)
-{
-	SDL_RenderCopy(_sg_renderer, texture, &src, &dst);
+		int i = 0;
+		for(const SgCommand *c = cmd; c < end; ++c)
+		{
+			if(sg_command_visible(c, clip))
+			{
+				_sg_rects[i++] = c->Dst;
+			}
+		}
+
+		sg_set_color(first->Color);
+		++_sg_stats.DrawCalls;
+		SDL_RenderFillRects(_sg_renderer, _sg_rects, count);
+	}
+	else
+	{
+		/* Mixed colors: untextured geometry with the color per vertex,
+			which keeps the drawing order of overlapping rects intact */
+		sg_batch_begin(NULL, count);
+		for(; cmd < end; ++cmd)
+		{
+			if(sg_command_visible(cmd, clip))
+			{
+				sg_batch_quad(cmd->Dst, cmd->Dst, cmd->Color);
+			}
+		}
+
+		sg_batch_end();
+	}
 }
 
-/* ========================================================================== */
-/* event handling */
-static void sg_handle_mouse_scroll(SDL_Event *e)
+static void sg_flush_quads(const SgCommand *cmd, const SgCommand *end, const SgRect *clip)
 {
-	_sg_scroll = sg_point(e->wheel.x, e->wheel.y);
+	bool begun = false;
+	for(; cmd < end; ++cmd)
+	{
+		if(sg_command_visible(cmd, clip))
+		{
+			if(!begun)
+			{
+				sg_batch_begin(cmd->Texture, end - cmd);
+				begun = true;
+			}
+
+			sg_batch_quad(cmd->Src, cmd->Dst, cmd->Color);
+		}
+	}
+
+	sg_batch_end();
 }
 
-static void sg_handle_mouse_button_down(SDL_Event *e)
+/* Adjacent commands of the same kind that use the same texture
+	are merged into a single run */
+static void sg_flush_list(const SgCommandList *list, const SgRect *clip)
 {
-	if(e->button.button == SDL_BUTTON_LEFT)
+	const SgCommand *cmd = list->Commands;
+	const SgCommand *end = cmd + list->Count;
+	while(cmd < end)
 	{
-		_sg_selected = false;
-
-		SgPoint click_point = sg_point(e->button.x, e->button.y);
+		if(cmd->Type == SG_CMD_NONE)
+		{
+			++cmd;
+			continue;
+		}
 
-		uint32_t time = SDL_GetTicks();
-		if(time < sg_triple_click_time + sg_double_click_ms &&
-			sg_point_eq(sg_multi_click_point, click_point))
+		const SgCommand *run = cmd;
+		for(++cmd; cmd < end; ++cmd)
 		{
-			sg_double_click_time = 0;
-			sg_triple_click_time = 0;
-			sg_triple_click = true;
+			if(cmd->Type != SG_CMD_NONE &&
+				(cmd->Type != run->Type || cmd->Texture != run->Texture))
+			{
+				break;
+			}
 		}
-		else if(time < sg_double_click_time + sg_double_click_ms &&
-			sg_point_eq(sg_multi_click_point, click_point))
+
+		if(run->Type == SG_CMD_RECT)
 		{
-			sg_triple_click_time = sg_double_click_time;
-			sg_double_click_time = 0;
-			sg_double_click = true;
+			sg_flush_rects(run, cmd, clip);
 		}
 		else
 		{
-			sg_double_click_time = time;
-			sg_multi_click_point = click_point;
+			sg_flush_quads(run, cmd, clip);
 		}
 	}
-
-	_sg_mouse_button_pressed |= SDL_BUTTON(e->button.button);
 }
 
-static void sg_handle_mouse_button_up(SDL_Event *e)
+/* Draws the whole frame, or only the part within clip */
+static void sg_commands_flush(const SgRect *clip)
 {
-	if(e->button.button == SDL_BUTTON_LEFT)
+	sg_set_color(_sg_clear_color);
+	++_sg_stats.DrawCalls;
+	if(clip)
 	{
-		_sg_drag = false;
-		_sg_tb_multi_clicked = false;
+		/* SDL_RenderClear ignores the clip rectangle */
+		SDL_RenderSetClipRect(_sg_renderer, clip);
+		SDL_RenderFillRect(_sg_renderer, clip);
+	}
+	else
+	{
+		SDL_RenderClear(_sg_renderer);
 	}
 
-	_sg_mouse_button_released |= SDL_BUTTON(e->button.button);
+	for(int i = 0; i < SG_LAYER_COUNT; ++i)
+	{
+		sg_flush_list(&_sg_layers[i], clip);
+	}
 }
 
-static void sg_handle_key_down(SDL_Event *e)
+/* ========================================================================== */
+/* dirty rectangles */
+void sg_set_dirty_rects(bool enabled)
 {
-	_sg_key_pressed[e->key.keysym.scancode] = 1;
+	_sg_dirty_rects = enabled;
+	_sg_force_present = true;
+}
 
-	if(_sg_keys_top < SG_MAX_KEYS)
+static SgRect sg_group_bounds(const SgCommandList *layers, const SgCommandGroup *group)
+{
+	const SgCommand *cmd = layers[group->Layer].Commands + group->First;
+	SgRect bounds = cmd->Dst;
+	for(int i = 1; i < group->Count; ++i)
 	{
-		int key = sg_key_convert(e->key.keysym.scancode, e->key.keysym.mod);
-		_sg_keys[_sg_keys_top++] = key;
+		SDL_UnionRect(&bounds, &cmd[i].Dst, &bounds);
 	}
-}
 
-static void sg_handle_key_up(SDL_Event *e)
-{
-	_sg_key_released[e->key.keysym.scancode] = 1;
+	return bounds;
 }
 
-void sg_begin(void)
+static int sg_damage_add(int count, SgRect r)
 {
-	_sg_select_items = NULL;
-
-	sg_double_click = false;
-	sg_triple_click = false;
+	if(r.w <= 0 || r.h <= 0)
+	{
+		return count;
+	}
 
-	_sg_keys_top = 0;
-	_sg_scroll = sg_point(0, 0);
-	_sg_mouse_button_pressed = 0;
-	_sg_mouse_button_released = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		if(SDL_HasIntersection(&_sg_damage[i], &r))
+		{
+			SDL_UnionRect(&_sg_damage[i], &r, &_sg_damage[i]);
+			return count;
+		}
+	}
 
-	memset(_sg_key_pressed, 0, _sg_num_keys);
-	memset(_sg_key_released, 0, _sg_num_keys);
+	if(count < SG_MAX_DAMAGE)
+	{
+		_sg_damage[count] = r;
+		return count + 1;
+	}
 
-	SDL_Event e;
-	while(SDL_PollEvent(&e))
+	/* Too many separate regions, fall back to their bounding box */
+	for(int i = 1; i < count; ++i)
 	{
-		switch(e.type)
-		{
-		case SDL_QUIT:
-			_sg_running = false;
-			break;
+		SDL_UnionRect(&_sg_damage[0], &_sg_damage[i], &_sg_damage[0]);
+	}
 
-		case SDL_MOUSEWHEEL:
-			sg_handle_mouse_scroll(&e);
-			break;
+	SDL_UnionRect(&_sg_damage[0], &r, &_sg_damage[0]);
+	return 1;
+}
 
-		case SDL_MOUSEBUTTONDOWN:
-			sg_handle_mouse_button_down(&e);
-			break;
+/* Compares the groups of the recorded frame with the last submitted one.
+	Returns the number of damaged rectangles in _sg_damage,
+	or -1 if the whole frame has to be redrawn. */
+static int sg_damage_compute(void)
+{
+	if(_sg_clear_color != _sg_prev_clear_color ||
+		_sg_groups.Count != _sg_prev_groups.Count)
+	{
+		return -1;
+	}
 
-		case SDL_MOUSEBUTTONUP:
-			sg_handle_mouse_button_up(&e);
-			break;
+	int count = 0;
+	for(int i = 0; i < _sg_groups.Count; ++i)
+	{
+		const SgCommandGroup *cur = &_sg_groups.Groups[i];
+		const SgCommandGroup *prev = &_sg_prev_groups.Groups[i];
+		if(cur->Layer != prev->Layer)
+		{
+			return -1;
+		}
 
-		case SDL_KEYDOWN:
-			sg_handle_key_down(&e);
-			break;
+		const SgCommand *cmd = _sg_layers[cur->Layer].Commands + cur->First;
+		if(cur->Count == prev->Count &&
+			!memcmp(cmd, _sg_prev_layers[prev->Layer].Commands + prev->First,
+				cur->Count * sizeof(SgCommand)) &&
+			!sg_commands_stale(cmd, cur->Count))
+		{
+			continue;
+		}
 
-		case SDL_KEYUP:
-			sg_handle_key_up(&e);
-			break;
+		count = sg_damage_add(count, sg_group_bounds(_sg_prev_layers, prev));
+		count = sg_damage_add(count, sg_group_bounds(_sg_layers, cur));
+	}
+
+	/* Growing a rect can make it overlap others, which would then
+		be drawn twice. Merge until all of them are disjoint. */
+	for(int i = 0; i < count; ++i)
+	{
+		for(int j = i + 1; j < count; ++j)
+		{
+			if(SDL_HasIntersection(&_sg_damage[i], &_sg_damage[j]))
+			{
+				SDL_UnionRect(&_sg_damage[i], &_sg_damage[j], &_sg_damage[i]);
+				_sg_damage[j] = _sg_damage[--count];
+				i = -1;
+				break;
+			}
 		}
 	}
 
-	sg_set_color(sg_theme->WindowBackgroundColor);
-	SDL_RenderClear(_sg_renderer);
+	return count;
 }
 
-void sg_update(void)
+/* Creates the persistent render target, returns false if that fails */
+static bool sg_target_prepare(bool *full)
 {
-	sg_select_render_dropdown();
+	SgSize size;
+	SDL_GetRendererOutputSize(_sg_renderer, &size.w, &size.h);
+	if(_sg_target && size.w == _sg_target_size.w && size.h == _sg_target_size.h)
+	{
+		return true;
+	}
+
+	if(_sg_target)
+	{
+		SDL_DestroyTexture(_sg_target);
+		_sg_target = NULL;
+	}
+
+	if(!SDL_RenderTargetSupported(_sg_renderer))
+	{
+		return false;
+	}
 
-	SDL_RenderPresent(_sg_renderer);
+	_sg_target = SDL_CreateTexture(_sg_renderer, SDL_PIXELFORMAT_ARGB8888,
+		SDL_TEXTUREACCESS_TARGET, size.w, size.h);
+	_sg_target_size = size;
+	*full = true;
+	return _sg_target != NULL;
 }
 
-bool sg_running(void)
+static void sg_commands_submit(void)
 {
-	return _sg_running;
+	bool full = _sg_force_present;
+	if(_sg_dirty_rects && sg_target_prepare(&full))
+	{
+		SDL_SetRenderTarget(_sg_renderer, _sg_target);
+		int count = full ? -1 : sg_damage_compute();
+		if(count < 0)
+		{
+			sg_commands_flush(NULL);
+		}
+		else
+		{
+			for(int i = 0; i < count; ++i)
+			{
+				sg_commands_flush(&_sg_damage[i]);
+			}
+
+			SDL_RenderSetClipRect(_sg_renderer, NULL);
+		}
+
+		SDL_SetRenderTarget(_sg_renderer, NULL);
+		sg_set_texture(_sg_target);
+		++_sg_stats.DrawCalls;
+		SDL_RenderCopy(_sg_renderer, _sg_target, NULL, NULL);
+	}
+	else
+	{
+		sg_commands_flush(NULL);
+	}
 }
 
 /* ========================================================================== */
-/* mouse handling */
-bool sg_is_mouse_button_down(int button)
-{
-	return ((SDL_GetMouseState(NULL, NULL) & button) != 0) || sg_is_mouse_button_pressed(button);
+/* debug hud */
+#define SG_HUD_SAMPLES 120
+#define SG_HUD_WIDTH   (2 * SG_HUD_SAMPLES + 8)
+#define SG_HUD_GRAPH   48
+#define SG_HUD_LINES   3
+
+static bool _sg_hud_enabled;
+static float _sg_hud_samples[SG_HUD_SAMPLES];
+static int _sg_hud_pos;
+static int _sg_hud_count;
+
+void sg_set_debug_hud(bool enabled)
+{
+	_sg_hud_enabled = enabled;
+	_sg_hud_pos = 0;
+	_sg_hud_count = 0;
+	_sg_force_present = true;
 }
 
-bool sg_is_mouse_button_pressed(int button)
+bool sg_get_debug_hud(void)
 {
-	return (_sg_mouse_button_pressed & button) != 0;
+	return _sg_hud_enabled;
 }
 
-bool sg_is_mouse_button_released(int button)
+static int sg_hud_compare(const void *a, const void *b)
 {
-	return (_sg_mouse_button_released & button) != 0;
+	float x = *(const float *)a;
+	float y = *(const float *)b;
+	return (x > y) - (x < y);
 }
 
-SgPoint sg_mouse_position(void)
+static void sg_hud_render(void)
 {
-	int x, y;
-	SDL_GetMouseState(&x, &y);
-	return sg_point(x, y);
+	const SgFrameStats *stats = &_sg_last_stats;
+	if(stats->FrameMs > 0)
+	{
+		_sg_hud_samples[_sg_hud_pos] = stats->FrameMs;
+		_sg_hud_pos = (_sg_hud_pos + 1) % SG_HUD_SAMPLES;
+		if(_sg_hud_count < SG_HUD_SAMPLES)
+		{
+			++_sg_hud_count;
+		}
+	}
+
+	float sorted[SG_HUD_SAMPLES];
+	float p50 = 0, p99 = 0, max = 1000.0f / 30;
+	if(_sg_hud_count)
+	{
+		memcpy(sorted, _sg_hud_samples, _sg_hud_count * sizeof(*sorted));
+		qsort(sorted, _sg_hud_count, sizeof(*sorted), sg_hud_compare);
+		p50 = sorted[_sg_hud_count / 2];
+		p99 = sorted[(_sg_hud_count * 99) / 100];
+		if(sorted[_sg_hud_count - 1] > max)
+		{
+			max = sorted[_sg_hud_count - 1];
+		}
+	}
+
+	char text[SG_HUD_LINES][64];
+	snprintf(text[0], sizeof(text[0]), "%.1f ms  p50 %.1f  p99 %.1f",
+		stats->FrameMs, p50, p99);
+	snprintf(text[1], sizeof(text[1]), "draws %d  glyphs %d  rects %d",
+		stats->DrawCalls, stats->Glyphs, stats->Rects);
+	snprintf(text[2], sizeof(text[2]), "cpu %.2f ms  widgets %d",
+		stats->BeginMs + stats->WidgetMs + stats->UpdateMs, stats->Widgets);
+
+	int width = SG_HUD_WIDTH;
+	for(int i = 0; i < SG_HUD_LINES; ++i)
+	{
+		width = sg_max(width, sg_string_width(text[i]) + 8);
+	}
+
+	/* The HUD is not part of what it measures */
+	int glyphs = _sg_stats.Glyphs;
+	int rects = _sg_stats.Rects;
+	int widgets = _sg_stats.Widgets;
+	SgCommandList *overlay = &_sg_layers[SG_LAYER_OVERLAY];
+	int first = overlay->Count;
+	int groups = _sg_groups.Count;
+
+	sg_zone_begin("sg_hud");
+	sg_widget_begin();
+	sg_set_layer(SG_LAYER_OVERLAY);
+
+	int line = _sg_fontatlas->FontHeight;
+	SgSize ws = sg_get_window_size();
+	SgRect r = sg_rect(ws.w - width, 0, width, SG_HUD_GRAPH + SG_HUD_LINES * line + 12);
+	sg_fill_rect(r, SG_BLACK);
+
+	/* Graph, oldest sample on the left, line at 60 FPS */
+	int base = r.y + 4 + SG_HUD_GRAPH;
+	for(int i = 0; i < _sg_hud_count; ++i)
+	{
+		int idx = (_sg_hud_pos - _sg_hud_count + i + SG_HUD_SAMPLES) % SG_HUD_SAMPLES;
+		float v = _sg_hud_samples[idx];
+		int h = sg_max(1, (int)(v / max * SG_HUD_GRAPH));
+		SgColor color = (v > 1000.0f / 30) ? SG_RED :
+			(v > 1000.0f / 60 + 1) ? SG_YELLOW : SG_LIME;
+		sg_fill_rect(sg_rect(r.x + 4 + 2 * i, base - h, 2, h), color);
+	}
+
+	int y60 = base - (int)(1000.0f / 60 / max * SG_HUD_GRAPH);
+	sg_fill_rect(sg_rect(r.x + 4, y60, 2 * SG_HUD_SAMPLES, 1), SG_GRAY);
+
+	for(int i = 0; i < SG_HUD_LINES; ++i)
+	{
+		sg_render_string(sg_point(r.x + 4, base + 4 + i * line), text[i], SG_WHITE);
+	}
+
+	sg_set_layer(SG_LAYER_BASE);
+	sg_widget_end();
+	sg_zone_end();
+
+	_sg_stats.Glyphs = glyphs;
+	_sg_stats.Rects = rects;
+	_sg_stats.Widgets = widgets;
+
+	/* Moved out of the frame, so the HUD changing every frame neither
+		keeps event driven mode from idling nor damages the frame below */
+	int count = overlay->Count - first;
+	if(count > _sg_hud_commands.Capacity)
+	{
+		_sg_hud_commands.Capacity = count;
+		_sg_hud_commands.Commands = sg_realloc(_sg_hud_commands.Commands,
+			count * sizeof(SgCommand));
+	}
+
+	memcpy(_sg_hud_commands.Commands, overlay->Commands + first,
+		count * sizeof(SgCommand));
+	_sg_hud_commands.Count = count;
+	overlay->Count = first;
+	_sg_groups.Count = groups;
+	_sg_group_current = -1;
 }
 
-SgPoint sg_mouse_wheel(void)
+/* Draws the HUD straight to the screen, on top of the submitted frame */
+static void sg_hud_submit(void)
 {
-	return _sg_scroll;
+	SgFrameStats stats = _sg_stats;
+	sg_flush_list(&_sg_hud_commands, NULL);
+	_sg_stats.DrawCalls = stats.DrawCalls;
+	_sg_stats.TextureBinds = stats.TextureBinds;
+	_sg_stats.StateChanges = stats.StateChanges;
+	_sg_stats.StateElided = stats.StateElided;
 }
 
 /* ========================================================================== */
-/* keyboard handling */
-bool sg_is_key_down(SDL_Scancode key)
+/* font rendering */
+SgFont sg_font_load(const char *file, int size)
 {
-	return _sg_key_state[key];
+	return TTF_OpenFont(file, size);
 }
 
-bool sg_is_key_pressed(SDL_Scancode key)
+void sg_font_destroy(SgFont font)
 {
-	return _sg_key_pressed[key];
+	TTF_CloseFont(font);
 }
 
-bool sg_is_key_released(SDL_Scancode key)
-{
-	return _sg_key_released[key];
-}
+/* Largest atlas side the packer grows to */
+#ifndef SG_ATLAS_MAX_SIZE
+#define SG_ATLAS_MAX_SIZE 8192
+#endif
 
-/* ========================================================================== */
-/* keyboard layouts */
-int sg_key_convert(int scancode, int mod)
+/* Atlas pixels are only coverage, one byte each. The color comes from the
+	vertex color when drawing, so the texture is white with that alpha. */
+#ifndef SG_ATLAS_ALLOW_16BIT
+#define SG_ATLAS_ALLOW_16BIT 0
+#endif
+
+#ifndef SG_FONTATLAS_MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define SG_FONTATLAS_MMAP 1
+#else
+#define SG_FONTATLAS_MMAP 0
+#endif
+#endif
+
+#if SG_FONTATLAS_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static void sg_fontatlas_resize(SgFontAtlas atlas, int w, int h);
+static void sg_fontatlas_free_pixels(SgFontAtlas atlas);
+
+/* Marks r for upload. When all slots are taken, r is merged into the
+	rect whose area grows the least. */
+static void sg_fontatlas_touch(SgFontAtlas atlas, SgRect r)
 {
-	int key = scancode;
-	if(mod & (KMOD_LCTRL | KMOD_RCTRL))
+	if(r.w <= 0 || r.h <= 0)
 	{
-		key |= MOD_CTRL;
+		return;
 	}
 
-	if(mod & KMOD_LALT)
+	if(!atlas->DirtyCount)
 	{
-		key |= MOD_ALT;
-	}
+		if(_sg_dirty_atlas_count == _sg_dirty_atlas_capacity)
+		{
+			_sg_dirty_atlas_capacity = _sg_dirty_atlas_capacity ? 2 * _sg_dirty_atlas_capacity : 4;
+			_sg_dirty_atlases = sg_realloc(_sg_dirty_atlases,
+				_sg_dirty_atlas_capacity * sizeof(SgFontAtlas));
+		}
 
-	if(mod & KMOD_RALT)
-	{
-		key |= MOD_ALT_GR;
+		_sg_dirty_atlases[_sg_dirty_atlas_count++] = atlas;
 	}
 
-	if(mod & (KMOD_LGUI | KMOD_RGUI))
+	if(atlas->DirtyCount < SG_ATLAS_DIRTY_RECTS)
 	{
-		key |= MOD_OS;
+		atlas->DirtyRects[atlas->DirtyCount++] = r;
+		return;
 	}
 
-	if(mod & (KMOD_LSHIFT | KMOD_RSHIFT))
+	int best = 0;
+	long best_growth = -1;
+	SgRect best_union = r;
+	for(int i = 0; i < atlas->DirtyCount; ++i)
 	{
-		key |= MOD_SHIFT;
+		SgRect d = atlas->DirtyRects[i];
+		int x0 = sg_min(d.x, r.x);
+		int y0 = sg_min(d.y, r.y);
+		int x1 = sg_max(d.x + d.w, r.x + r.w);
+		int y1 = sg_max(d.y + d.h, r.y + r.h);
+		long growth = (long)(x1 - x0) * (y1 - y0) - (long)d.w * d.h;
+		if(best_growth < 0 || growth < best_growth)
+		{
+			best = i;
+			best_growth = growth;
+			best_union = sg_rect(x0, y0, x1 - x0, y1 - y0);
+		}
 	}
 
-	return key;
+	atlas->DirtyRects[best] = best_union;
 }
 
-int sg_key_to_codepoint_german(int k)
+/* Adds shelves below the old ones, the atlas only gets wider when a glyph
+	does not fit or it would become too narrow. The glyphs keep their place. */
+static bool sg_fontatlas_grow(SgFontAtlas atlas, int min_w)
 {
-	int nomods = k & 0xFF;
-
-	if(nomods == SDL_SCANCODE_TAB)                             { return '\t'; }
-	else if(nomods == SDL_SCANCODE_BACKSPACE)                  { return '\b'; }
-	else if(nomods == SDL_SCANCODE_RETURN)                     { return '\n'; }
-	else if(nomods == SDL_SCANCODE_SPACE)                      { return ' '; }
-	else if(k == (SDL_SCANCODE_COMMA | MOD_SHIFT))             { return ';'; }
-	else if(k == (SDL_SCANCODE_COMMA))                         { return ','; }
-	else if(k == (SDL_SCANCODE_PERIOD | MOD_SHIFT))            { return ':'; }
-	else if(k == (SDL_SCANCODE_PERIOD))                        { return '.'; }
-	else if(k == (SDL_SCANCODE_SLASH | MOD_SHIFT))             { return '_'; }
-	else if(k == (SDL_SCANCODE_SLASH))                         { return '-'; }
-	else if(k == (SDL_SCANCODE_BACKSLASH | MOD_SHIFT))         { return '\''; }
-	else if(k == (SDL_SCANCODE_BACKSLASH))                     { return '#'; }
-	else if(k == (SDL_SCANCODE_RIGHTBRACKET | MOD_SHIFT))      { return '*'; }
-	else if(k == (SDL_SCANCODE_RIGHTBRACKET | MOD_ALT_GR))     { return '~'; }
-	else if(k == (SDL_SCANCODE_RIGHTBRACKET))                  { return '+'; }
-	else if(k == (SDL_SCANCODE_NONUSBACKSLASH | MOD_SHIFT))    { return '>'; }
-	else if(k == (SDL_SCANCODE_NONUSBACKSLASH | MOD_ALT_GR))   { return '|'; }
-	else if(k == SDL_SCANCODE_NONUSBACKSLASH)                  { return '<'; }
-	else if(k == (SDL_SCANCODE_MINUS | MOD_SHIFT))             { return '?'; }
-	else if(k == (SDL_SCANCODE_MINUS | MOD_ALT_GR))            { return '\\'; }
-	else if(k == (SDL_SCANCODE_EQUALS | MOD_SHIFT))            { return '`'; }
-	else if(k == SDL_SCANCODE_GRAVE)                           { return '^'; }
-	else if(nomods >= SDL_SCANCODE_A && nomods <= SDL_SCANCODE_Z)
+	int w = atlas->Size.w;
+	int h = atlas->Size.h;
+	if(w < min_w || h >= 2 * w)
 	{
-		int c = nomods - SDL_SCANCODE_A + 'a';
+		w *= 2;
+	}
+	else
+	{
+		h *= 2;
+	}
 
-		if(c == 'z') { c = 'y'; }
-		else if(c == 'y') { c = 'z'; }
+	if(w > SG_ATLAS_MAX_SIZE || h > SG_ATLAS_MAX_SIZE)
+	{
+		return false;
+	}
 
-		if(k & MOD_ALT_GR)
+	sg_fontatlas_resize(atlas, w, h);
+	return true;
+}
+
+static void sg_fontatlas_resize(SgFontAtlas atlas, int w, int h)
+{
+	uint8_t *pixels = sg_calloc((size_t)w * h, 1);
+	for(int y = 0; y < atlas->Size.h; ++y)
+	{
+		memcpy(pixels + (size_t)y * w,
+			atlas->Pixels + (size_t)y * atlas->Size.w, atlas->Size.w);
+	}
+
+	sg_fontatlas_free_pixels(atlas);
+	atlas->Pixels = pixels;
+	atlas->Size = sg_size(w, h);
+
+	/* The texture is created again with the new size */
+	atlas->DirtyCount = 0;
+	sg_fontatlas_touch(atlas, sg_rect(0, 0, w, h));
+}
+
+/* Places a glyph on the current shelf, or starts a new shelf below it.
+	One pixel of padding keeps neighbours from bleeding into each other. */
+static bool sg_fontatlas_pack(SgFontAtlas atlas, SgSize size, SgRect *r)
+{
+	int w = size.w + 1;
+	int h = size.h + 1;
+	if(atlas->Font)
+	{
+		/* The space below is owned by the glyph cache */
+		fprintf(stderr, "SimpleGUI: characters and icons have to be added "
+			"to a font atlas before sg_fontatlas_enable_cache\n");
+		return false;
+	}
+
+	for(;;)
+	{
+		SgSize s = atlas->Size;
+		if(atlas->ShelfX + w > s.w && atlas->ShelfX > 0 && w <= s.w)
 		{
-			if(c == 'q') { return '@'; }
+			atlas->ShelfY += atlas->ShelfHeight;
+			atlas->ShelfX = 0;
+			atlas->ShelfHeight = 0;
 		}
 
-		if(k & MOD_SHIFT)
+		if(atlas->ShelfX + w <= s.w &&
+			atlas->ShelfY + sg_max(atlas->ShelfHeight, h) <= s.h)
 		{
-			c = toupper(c);
+			*r = sg_rect(atlas->ShelfX, atlas->ShelfY, size.w, size.h);
+			atlas->ShelfX += w;
+			atlas->ShelfHeight = sg_max(atlas->ShelfHeight, h);
+			return true;
 		}
 
-		return c;
+		if(!sg_fontatlas_grow(atlas, atlas->ShelfX + w))
+		{
+			return false;
+		}
 	}
-	else if(nomods >= SDL_SCANCODE_1 && nomods <= SDL_SCANCODE_0)
+}
+
+/* Finds the place for glyph index, reusing its old place if it fits */
+static bool sg_fontatlas_place(SgFontAtlas atlas, SgSize size, uint8_t index, SgRect *r)
+{
+	SgRect old = atlas->CharRect[index];
+	if(size.w > old.w || size.h > old.h)
 	{
-		static const uint8_t numbers[] =
-			{ '1', '2', '3', '4', '5', '6', '7', '8', '9', '0' };
+		if(!sg_fontatlas_pack(atlas, size, &old))
+		{
+			return false;
+		}
+	}
 
-		static const uint8_t numbers_shift[] =
-			{ '!', '\"', 0, '$', '%', '&', '/', '(', ')', '=' };
+	atlas->UsedPixels += size.w * size.h - atlas->CharRect[index].w * atlas->CharRect[index].h;
+	*r = sg_rect(old.x, old.y, size.w, size.h);
+	atlas->CharRect[index] = *r;
+	return true;
+}
 
-		static const uint8_t numbers_altgr[] =
-			{ 0, 0, 0, 0, 0, 0, '{', '[', ']', '}' };
+/* max_char_size only sets the initial size, the atlas grows as glyphs are added */
+SgFontAtlas sg_font_atlas_create(int max_char_size, int font_height)
+{
+	int side = 64;
+	while(side < max_char_size && side < SG_ATLAS_MAX_SIZE)
+	{
+		side *= 2;
+	}
 
-		int idx = nomods - SDL_SCANCODE_1;
+	SgFontAtlasInternal *atlas = sg_calloc(1, sizeof(SgFontAtlasInternal));
+	atlas->FontHeight = font_height;
+	atlas->MaxCharSize = max_char_size;
+	atlas->Size = sg_size(side, side);
+	atlas->Pixels = sg_calloc((size_t)side * side, 1);
+	atlas->Texture = NULL;
 
-		if(k & MOD_SHIFT)
+	/* The first glyph slot is a small white block so that filled rects
+		can be drawn from the same texture as text. The rect used for
+		sampling is surrounded by white texels. */
+	SgRect block;
+	sg_fontatlas_pack(atlas, sg_size(3, 3), &block);
+	for(int y = 0; y < block.h; ++y)
+	{
+		memset(atlas->Pixels + (size_t)(block.y + y) * side + block.x, 0xFF, block.w);
+	}
+
+	atlas->White = sg_rect(block.x + 1, block.y + 1, 1, 1);
+	atlas->UsedPixels = 9;
+	return atlas;
+}
+
+double sg_fontatlas_fill_ratio(SgFontAtlas atlas)
+{
+	return (double)atlas->UsedPixels / ((double)atlas->Size.w * atlas->Size.h);
+}
+
+void sg_set_fontatlas(SgFontAtlas atlas)
+{
+	_sg_fontatlas = atlas;
+}
+
+static void sg_fontatlas_free_pixels(SgFontAtlas atlas)
+{
+#if SG_FONTATLAS_MMAP
+	if(atlas->Mapping)
+	{
+		munmap(atlas->Mapping, atlas->MappingSize);
+		atlas->Mapping = NULL;
+		atlas->Pixels = NULL;
+		return;
+	}
+#endif
+
+	sg_free(atlas->Pixels);
+	atlas->Pixels = NULL;
+}
+
+void sg_fontatlas_destroy(SgFontAtlas atlas)
+{
+	for(int i = 0; i < _sg_dirty_atlas_count; ++i)
+	{
+		if(_sg_dirty_atlases[i] == atlas)
 		{
-			return numbers_shift[idx];
+			_sg_dirty_atlases[i--] = _sg_dirty_atlases[--_sg_dirty_atlas_count];
 		}
-		else if(k & MOD_ALT_GR)
+	}
+
+	sg_fontatlas_free_pixels(atlas);
+	sg_free(atlas->CacheShelves);
+	sg_free(atlas->Glyphs);
+	if(atlas->Texture)
+	{
+		sg_texture_destroy(atlas->Texture);
+	}
+
+	sg_free(atlas);
+}
+
+static uint32_t sg_get_pixel(SgSurface s, int x, int y)
+{
+	uint32_t *pixels = s->pixels;
+	return pixels[y * (s->pitch / 4) + x];
+}
+
+int sg_surface_color_to_binary(uint32_t color)
+{
+	return (color >> 24) > 127;
+}
+
+/* Only the alpha channel of the ARGB8888 surface s is kept */
+static void sg_fontatlas_copy_alpha(SgFontAtlas atlas, SgSurface s, SgRect src, SgRect dst)
+{
+	for(int y = 0; y < src.h; ++y)
+	{
+		uint8_t *row = atlas->Pixels + (size_t)(dst.y + y) * atlas->Size.w + dst.x;
+		for(int x = 0; x < src.w; ++x)
 		{
-			return numbers_altgr[idx];
+			row[x] = sg_get_pixel(s, src.x + x, src.y + y) >> 24;
+		}
+	}
+}
+
+int sg_fontatlas_blit_surface(SgFontAtlas atlas, SgSurface surface, SgRect src, uint8_t index)
+{
+	SgRect dst;
+	SgSurface s = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+	if(!s || !sg_fontatlas_place(atlas, sg_size(src.w, src.h), index, &dst))
+	{
+		SDL_FreeSurface(s);
+		return 1;
+	}
+
+	if(SG_FONTDEBUG)
+	{
+		/* print c array */
+		if(isprint(index))
+		{
+			printf("\t/* Char %d ('%c') */\n", index, index);
 		}
 		else
 		{
-			return numbers[idx];
+			printf("\t/* Char %d */\n", index);
+		}
+
+		for(int y = 0; y < src.h; ++y)
+		{
+			printf("\t");
+
+			int byte = 0;
+			int bit = 7;
+			for(int x = 0; x < src.w; ++x)
+			{
+				uint32_t color = sg_get_pixel(s, src.x + x, src.y + y);
+				if(sg_surface_color_to_binary(color))
+				{
+					byte |= (1 << bit);
+				}
+
+				--bit;
+				if(bit < 0)
+				{
+					printf("0x%02X, ", byte);
+					bit = 7;
+					byte = 0;
+				}
+			}
+
+			if((src.w & 3) != 0)
+			{
+				printf("0x%02X, ", byte);
+			}
+
+			printf("/* ");
+			for(int x = 0; x < src.w; ++x)
+			{
+				uint32_t color = sg_get_pixel(s, src.x + x, src.y + y);
+				printf("%c", sg_surface_color_to_binary(color) ? '#' : ' ');
+			}
+
+			printf(" */\n");
 		}
+
+		printf("\n");
 	}
 
+	sg_fontatlas_copy_alpha(atlas, s, src, dst);
+	sg_fontatlas_touch(atlas, dst);
+	SDL_FreeSurface(s);
 	return 0;
 }
 
-/* ========================================================================== */
-/* GUI GLOBAL STATE */
+int sg_fontatlas_add_char(SgFontAtlas atlas, SgFont font, uint8_t c)
+{
+	SDL_Color color = { 255, 255, 255, 0 };
+	char letter[2] = { c, '\0' };
+	SDL_Surface *s = TTF_RenderText_Blended(font, letter, color);
+	SDL_SetSurfaceBlendMode(s, SDL_BLENDMODE_NONE);
+	int status = sg_fontatlas_blit_surface(atlas, s, sg_rect(0, 0, s->w, s->h), c);
+	SDL_FreeSurface(s);
+	return status;
+}
 
-SgTheme sg_default_theme =
+int sg_fontatlas_add_ascii(SgFontAtlas atlas, SgFont font)
 {
-	/* Window */
-	.WindowBackgroundColor = 0x100000,
+	int status = 0;
+	for(int i = 32; i <= 126; ++i)
+	{
+		if(sg_fontatlas_add_char(atlas, font, i))
+		{
+			status = 1;
+		}
+	}
 
-	/* Label */
-	.LabelTextColor = 0xff8200,
+	return status;
+}
 
-	/* Button */
-	.ButtonTextColor = { 0xff8200, 0xff8200, 0xff8200 },
-	.ButtonInnerColor = { 0x310000, 0x7b0000, 0x510000 },
-	.ButtonBorderColor = { 0x7b0000, 0xff8200, 0xff8200 },
-	.ButtonBorderThickness = { 2, 2, 1 },
+int sg_fontatlas_add_utf8(SgFontAtlas atlas, SgFont font, const char *utf8, uint8_t index)
+{
+	SDL_Color color = { 255, 255, 255, 0 };
+	SDL_Surface *s = TTF_RenderUTF8_Blended(font, utf8, color);
+	int status = sg_fontatlas_blit_surface(atlas, s, sg_rect(0, 0, s->w, s->h), index);
+	SDL_FreeSurface(s);
+	return status;
+}
 
-	/* Checkbox */
-	.CheckboxIconColor = { 0xff8200, 0xff8200, 0xff8200 },
-	.CheckboxInnerColor = { 0x310000, 0x7b0000, 0x510000 },
-	.CheckboxBorderColor = { 0x7b0000, 0xff8200, 0xff8200 },
-	.CheckboxBorderThickness = { 2, 2, 1 },
+int sg_fontatlas_add_icon(SgFontAtlas atlas, const char *file, uint8_t index)
+{
+	SDL_Surface *s = IMG_Load(file);
+	if(!s)
+	{
+		return 1;
+	}
 
-	/* Textbox */
-	.TextboxTextColor = { 0xff8200, 0xff8200, 0xff8200 },
-	.TextboxInnerColor = { 0x310000, 0x7b0000, 0x510000 },
-	.TextboxBorderColor = { 0x7b0000, 0xff8200, 0xff8200 },
-	.TextboxBorderThickness = { 2, 2, 1 },
-	.TextboxPaddingX = 5,
-	.Cursor = { 0, 0, 2, 0 },
-	.CursorColor = 0xff8200,
-	.SelectionColor = 0xff8200,
-	.SelectionTextColor = 0x310000,
+	return sg_fontatlas_blit_surface(atlas, s, sg_rect(0, 0, s->w, s->h), index);
+}
+
+/* Rows are padded to whole bytes, the most significant bit is the left pixel */
+void sg_fontatlas_add_binary(SgFontAtlas atlas, const uint8_t *bytes, SgSize size, uint8_t index)
+{
+	SgRect dst;
+	if(!sg_fontatlas_place(atlas, size, index, &dst))
+	{
+		return;
+	}
+
+	int stride = (size.w + 7) / 8;
+	for(int y = 0; y < size.h; ++y)
+	{
+		const uint8_t *row = bytes + y * stride;
+		uint8_t *out = atlas->Pixels + (size_t)(dst.y + y) * atlas->Size.w + dst.x;
+		for(int x = 0; x < size.w; ++x)
+		{
+			out[x] = (row[x >> 3] & (0x80 >> (x & 7))) ? 0xFF : 0;
+		}
+	}
+
+	sg_fontatlas_touch(atlas, dst);
+}
+
+void sg_fontatlas_add_default_checkmark(SgFontAtlas atlas)
+{
+	sg_fontatlas_add_binary(atlas,
+		_sg_default_checkmark,
+		sg_size(16, 16), _sg_char_checkmark);
+}
+
+void sg_fontatlas_add_default_select(SgFontAtlas atlas)
+{
+	sg_fontatlas_add_binary(atlas,
+		_sg_default_select,
+		sg_size(16, 16), _sg_char_select);
+}
+
+void sg_fontatlas_add_default_icons(SgFontAtlas atlas)
+{
+	sg_fontatlas_add_default_checkmark(atlas);
+	sg_fontatlas_add_default_select(atlas);
+}
+
+/* The smallest texture format with alpha the renderer takes, 16 bit
+	formats only keep 16 levels of coverage so they need to be enabled */
+static uint32_t sg_fontatlas_format(void)
+{
+	if(SG_ATLAS_ALLOW_16BIT)
+	{
+		SDL_RendererInfo info;
+		if(!SDL_GetRendererInfo(_sg_renderer, &info))
+		{
+			for(uint32_t i = 0; i < info.num_texture_formats; ++i)
+			{
+				if(info.texture_formats[i] == SDL_PIXELFORMAT_ARGB4444)
+				{
+					return SDL_PIXELFORMAT_ARGB4444;
+				}
+			}
+		}
+	}
+
+	return SDL_PIXELFORMAT_ARGB8888;
+}
+
+/* Expands coverage to white texels of the texture format */
+static void *sg_fontatlas_expand(SgFontAtlas atlas, uint32_t format, SgRect r, int *pitch)
+{
+	bool small = format == SDL_PIXELFORMAT_ARGB4444;
+	*pitch = r.w * (small ? 2 : 4);
+	uint8_t *out = sg_malloc((size_t)*pitch * r.h);
+	for(int y = 0; y < r.h; ++y)
+	{
+		const uint8_t *row = atlas->Pixels + (size_t)(r.y + y) * atlas->Size.w + r.x;
+		if(small)
+		{
+			uint16_t *dst = (uint16_t *)(out + (size_t)y * *pitch);
+			for(int x = 0; x < r.w; ++x)
+			{
+				dst[x] = ((row[x] >> 4) << 12) | 0x0FFF;
+			}
+		}
+		else
+		{
+			uint32_t *dst = (uint32_t *)(out + (size_t)y * *pitch);
+			for(int x = 0; x < r.w; ++x)
+			{
+				dst[x] = ((uint32_t)row[x] << 24) | 0xFFFFFF;
+			}
+		}
+	}
+
+	return out;
+}
+
+/* Creates the texture when there is none or the atlas has grown, and
+	otherwise only uploads the areas that changed since the last update */
+void sg_fontatlas_update(SgFontAtlas atlas)
+{
+	SgRect all = sg_rect(0, 0, atlas->Size.w, atlas->Size.h);
+	uint32_t format = sg_fontatlas_format();
+	uint32_t texture_format = 0;
+	int w = 0;
+	int h = 0;
+	if(atlas->Texture)
+	{
+		SDL_QueryTexture(atlas->Texture, &texture_format, NULL, &w, &h);
+	}
+
+	if(SG_FONTDEBUG)
+	{
+		int pitch;
+		void *argb = sg_fontatlas_expand(atlas, SDL_PIXELFORMAT_ARGB8888, all, &pitch);
+		SgSurface s = SDL_CreateRGBSurfaceWithFormatFrom(argb, all.w, all.h,
+			32, pitch, SDL_PIXELFORMAT_ARGB8888);
+		SDL_SaveBMP(s, "fontatlas.bmp");
+		SDL_FreeSurface(s);
+		sg_free(argb);
+	}
+
+	if(texture_format == format && w == all.w && h == all.h)
+	{
+		for(int i = 0; i < atlas->DirtyCount; ++i)
+		{
+			SgRect r = atlas->DirtyRects[i];
+			SDL_Rect dst = { r.x, r.y, r.w, r.h };
+			int pitch;
+			void *pixels = sg_fontatlas_expand(atlas, format, r, &pitch);
+			SDL_UpdateTexture(atlas->Texture, &dst, pixels, pitch);
+			sg_free(pixels);
+			sg_upload_add(atlas->Texture, r);
+		}
+
+		atlas->DirtyCount = 0;
+		return;
+	}
+
+	int pitch;
+	void *pixels = sg_fontatlas_expand(atlas, format, all, &pitch);
+	atlas->DirtyCount = 0;
+	SgTexture old = atlas->Texture;
+	atlas->Texture = SDL_CreateTexture(_sg_renderer, format,
+		SDL_TEXTUREACCESS_STATIC, all.w, all.h);
+	SDL_SetTextureBlendMode(atlas->Texture, SDL_BLENDMODE_BLEND);
+	SDL_UpdateTexture(atlas->Texture, NULL, pixels, pitch);
+	sg_free(pixels);
+	if(old)
+	{
+		/* Text recorded earlier in this frame switches to the new texture */
+		sg_commands_retarget(old, atlas->Texture);
+		sg_texture_destroy(old);
+	}
+}
+
+/* A header followed by the coverage of all pixels, row by row. Numbers
+	are stored in the byte order of the machine that saved the file. */
+#define SG_FONTATLAS_FILE_VERSION 1
+
+typedef struct
+{
+	char Magic[4];
+	uint32_t Version;
+	int32_t FontHeight;
+	int32_t MaxCharSize;
+	int32_t Width;
+	int32_t Height;
+	int32_t ShelfX;
+	int32_t ShelfY;
+	int32_t ShelfHeight;
+	int32_t UsedPixels;
+	int32_t White[4];
+	int32_t CharRect[256][4];
+} SgFontAtlasFile;
+
+static void sg_fontatlas_file_rect(int32_t out[4], SgRect r)
+{
+	out[0] = r.x;
+	out[1] = r.y;
+	out[2] = r.w;
+	out[3] = r.h;
+}
+
+/* Checks that every rect lies within the atlas, the pixels are not read */
+static bool sg_fontatlas_file_rect_valid(const int32_t r[4], const SgFontAtlasFile *f)
+{
+	return r[0] >= 0 && r[1] >= 0 && r[2] >= 0 && r[3] >= 0 &&
+		r[2] <= f->Width - r[0] && r[3] <= f->Height - r[1];
+}
+
+/* Creates an atlas without pixels from a checked header */
+static SgFontAtlas sg_fontatlas_from_file(const SgFontAtlasFile *f, size_t file_size)
+{
+	if(memcmp(f->Magic, "SGFA", 4) != 0 || f->Version != SG_FONTATLAS_FILE_VERSION ||
+		f->Width <= 0 || f->Width > SG_ATLAS_MAX_SIZE ||
+		f->Height <= 0 || f->Height > SG_ATLAS_MAX_SIZE ||
+		file_size != sizeof(SgFontAtlasFile) + (size_t)f->Width * f->Height ||
+		f->ShelfX < 0 || f->ShelfX > f->Width || f->ShelfY < 0 ||
+		f->ShelfHeight < 0 || f->ShelfHeight > f->Height - f->ShelfY ||
+		!sg_fontatlas_file_rect_valid(f->White, f))
+	{
+		return NULL;
+	}
+
+	for(int i = 0; i < 256; ++i)
+	{
+		if(!sg_fontatlas_file_rect_valid(f->CharRect[i], f))
+		{
+			return NULL;
+		}
+	}
+
+	SgFontAtlasInternal *atlas = sg_calloc(1, sizeof(SgFontAtlasInternal));
+	atlas->FontHeight = f->FontHeight;
+	atlas->MaxCharSize = f->MaxCharSize;
+	atlas->Size = sg_size(f->Width, f->Height);
+	atlas->ShelfX = f->ShelfX;
+	atlas->ShelfY = f->ShelfY;
+	atlas->ShelfHeight = f->ShelfHeight;
+	atlas->UsedPixels = f->UsedPixels;
+	atlas->White = sg_rect(f->White[0], f->White[1], f->White[2], f->White[3]);
+	for(int i = 0; i < 256; ++i)
+	{
+		const int32_t *r = f->CharRect[i];
+		atlas->CharRect[i] = sg_rect(r[0], r[1], r[2], r[3]);
+	}
+
+	return atlas;
+}
+
+/* The glyph cache is not saved */
+int sg_fontatlas_save(SgFontAtlas atlas, const char *file)
+{
+	SgFontAtlasFile f;
+	memset(&f, 0, sizeof(f));
+	memcpy(f.Magic, "SGFA", 4);
+	f.Version = SG_FONTATLAS_FILE_VERSION;
+	f.FontHeight = atlas->FontHeight;
+	f.MaxCharSize = atlas->MaxCharSize;
+	f.Width = atlas->Size.w;
+	f.Height = atlas->Size.h;
+	f.ShelfX = atlas->ShelfX;
+	f.ShelfY = atlas->ShelfY;
+	f.ShelfHeight = atlas->ShelfHeight;
+	f.UsedPixels = atlas->UsedPixels;
+	sg_fontatlas_file_rect(f.White, atlas->White);
+	for(int i = 0; i < 256; ++i)
+	{
+		sg_fontatlas_file_rect(f.CharRect[i], atlas->CharRect[i]);
+	}
+
+	FILE *fp = fopen(file, "wb");
+	if(!fp)
+	{
+		return 1;
+	}
+
+	size_t size = (size_t)atlas->Size.w * atlas->Size.h;
+	bool ok = fwrite(&f, sizeof(f), 1, fp) == 1 &&
+		fwrite(atlas->Pixels, 1, size, fp) == size;
+	return (fclose(fp) != 0 || !ok) ? 1 : 0;
+}
+
+/* The pixels are mapped from the file where possible: pages are only read
+	when they are touched, and changes to the atlas stay in memory. */
+SgFontAtlas sg_fontatlas_load(const char *file)
+{
+#if SG_FONTATLAS_MMAP
+	int fd = open(file, O_RDONLY);
+	if(fd < 0)
+	{
+		return NULL;
+	}
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SgFontAtlasFile))
+	{
+		map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+
+	close(fd);
+	if(map != MAP_FAILED)
+	{
+		SgFontAtlas atlas = sg_fontatlas_from_file(map, st.st_size);
+		if(!atlas)
+		{
+			munmap(map, st.st_size);
+			return NULL;
+		}
+
+		atlas->Mapping = map;
+		atlas->MappingSize = st.st_size;
+		atlas->Pixels = (uint8_t *)map + sizeof(SgFontAtlasFile);
+		return atlas;
+	}
+#endif
+
+	FILE *fp = fopen(file, "rb");
+	if(!fp)
+	{
+		return NULL;
+	}
+
+	SgFontAtlasFile f;
+	SgFontAtlas atlas = NULL;
+	if(fread(&f, sizeof(f), 1, fp) == 1 && fseek(fp, 0, SEEK_END) == 0)
+	{
+		long file_size = ftell(fp);
+		atlas = file_size > 0 ? sg_fontatlas_from_file(&f, file_size) : NULL;
+	}
+
+	if(atlas)
+	{
+		size_t size = (size_t)atlas->Size.w * atlas->Size.h;
+		atlas->Pixels = sg_malloc(size);
+		if(fseek(fp, sizeof(f), SEEK_SET) != 0 ||
+			fread(atlas->Pixels, 1, size, fp) != size)
+		{
+			sg_fontatlas_destroy(atlas);
+			atlas = NULL;
+		}
+	}
+
+	fclose(fp);
+	return atlas;
+}
+
+static int sg_render_glyph(SgPoint p, SDL_Rect src, SgColor color)
+{
+	int w = src.w;
+	SgRect dst = sg_rect(p.x, p.y, src.w, src.h);
+	if(!sg_clip(&src, &dst))
+	{
+		return w;
+	}
+
+	SgCommand *cmd = sg_command_push(SG_CMD_QUAD);
+	cmd->Texture = _sg_fontatlas->Texture;
+	cmd->Src = src;
+	cmd->Dst = dst;
+	cmd->Color = color;
+	++_sg_stats.Glyphs;
+	return w;
+}
+
+/* Glyph cache: codepoints are rendered from the font when first drawn.
+	The cache area is split into shelves of one line height, and a full
+	cache empties the shelf that was used least recently. */
+int sg_fontatlas_enable_cache(SgFontAtlas atlas, SgFont font, int size)
+{
+	int line = TTF_FontHeight(font) + 1;
+	int top = atlas->ShelfY + atlas->ShelfHeight;
+	if(atlas->Font || size > SG_ATLAS_MAX_SIZE || size - top < line)
+	{
+		return 1;
+	}
+
+	if(atlas->Size.w < size || atlas->Size.h < size)
+	{
+		sg_fontatlas_resize(atlas, sg_max(atlas->Size.w, size),
+			sg_max(atlas->Size.h, size));
+	}
+
+	atlas->Font = font;
+	atlas->CacheTop = top;
+	atlas->LineHeight = line;
+	atlas->CacheShelfCount = (atlas->Size.h - top) / line;
+	atlas->CacheShelves = sg_calloc(atlas->CacheShelfCount, sizeof(SgGlyphShelf));
+	atlas->GlyphCapacity = 256;
+	atlas->GlyphCount = 0;
+	atlas->Glyphs = sg_calloc(atlas->GlyphCapacity, sizeof(SgGlyph));
+	return 0;
+}
+
+static SgGlyph *sg_glyph_slot(SgFontAtlas atlas, uint32_t cp)
+{
+	uint32_t mask = atlas->GlyphCapacity - 1;
+	uint32_t h = cp * 2654435761u;
+	uint32_t i = (h ^ (h >> 16)) & mask;
+	while(atlas->Glyphs[i].Codepoint && atlas->Glyphs[i].Codepoint != cp)
+	{
+		i = (i + 1) & mask;
+	}
+
+	return &atlas->Glyphs[i];
+}
+
+/* Rebuilds the hash map, dropping the glyphs of shelf evict. Unless
+	keep_empty is set, codepoints remembered as empty are dropped too
+	and rendered again when they are drawn next. */
+static void sg_glyph_rehash(SgFontAtlas atlas, uint32_t capacity, int evict,
+	bool keep_empty)
+{
+	SgGlyph *old = atlas->Glyphs;
+	uint32_t old_capacity = atlas->GlyphCapacity;
+	atlas->Glyphs = sg_calloc(capacity, sizeof(SgGlyph));
+	atlas->GlyphCapacity = capacity;
+	atlas->GlyphCount = 0;
+	atlas->EmptyCount = 0;
+	for(uint32_t i = 0; i < old_capacity; ++i)
+	{
+		bool empty = old[i].Shelf < 0;
+		if(old[i].Codepoint && (empty ? keep_empty : old[i].Shelf != evict))
+		{
+			*sg_glyph_slot(atlas, old[i].Codepoint) = old[i];
+			++atlas->GlyphCount;
+			atlas->EmptyCount += empty;
+		}
+	}
+
+	sg_free(old);
+}
+
+/* A shelf with room for w pixels, evicting the least recently used one
+	when all are full. Shelves used in this frame are never evicted. */
+static int sg_glyph_shelf(SgFontAtlas atlas, int w)
+{
+	if(w > atlas->Size.w)
+	{
+		return -1;
+	}
+
+	int best = -1;
+	for(int i = 0; i < atlas->CacheShelfCount; ++i)
+	{
+		SgGlyphShelf *shelf = &atlas->CacheShelves[i];
+		if(shelf->X + w <= atlas->Size.w)
+		{
+			return i;
+		}
+
+		if(shelf->LastUsed != _sg_frame_number &&
+			(best < 0 || shelf->LastUsed < atlas->CacheShelves[best].LastUsed))
+		{
+			best = i;
+		}
+	}
+
+	if(best >= 0)
+	{
+		sg_glyph_rehash(atlas, atlas->GlyphCapacity, best, false);
+		atlas->CacheShelves[best].X = 0;
+		int y = atlas->CacheTop + best * atlas->LineHeight;
+		memset(atlas->Pixels + (size_t)y * atlas->Size.w, 0,
+			(size_t)atlas->LineHeight * atlas->Size.w);
+	}
+
+	return best;
+}
+
+static void sg_utf8_encode(uint32_t cp, char *out)
+{
+	if(cp < 0x80)
+	{
+		*out++ = cp;
+	}
+	else if(cp < 0x800)
+	{
+		*out++ = 0xC0 | (cp >> 6);
+		*out++ = 0x80 | (cp & 0x3F);
+	}
+	else if(cp < 0x10000)
+	{
+		*out++ = 0xE0 | (cp >> 12);
+		*out++ = 0x80 | ((cp >> 6) & 0x3F);
+		*out++ = 0x80 | (cp & 0x3F);
+	}
+	else
+	{
+		*out++ = 0xF0 | (cp >> 18);
+		*out++ = 0x80 | ((cp >> 12) & 0x3F);
+		*out++ = 0x80 | ((cp >> 6) & 0x3F);
+		*out++ = 0x80 | (cp & 0x3F);
+	}
+
+	*out = '\0';
+}
+
+/* Renders cp into the cache. A glyph that does not fit while every
+	shelf is in use is drawn as empty space, it is not rendered again
+	before the next frame. */
+static SgRect sg_glyph_add(SgFontAtlas atlas, uint32_t cp)
+{
+	char utf8[5];
+	sg_utf8_encode(cp, utf8);
+	SDL_Color white = { 255, 255, 255, 255 };
+	SgSurface rendered = TTF_RenderUTF8_Blended(atlas->Font, utf8, white);
+	SgSurface s = rendered ?
+		SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_ARGB8888, 0) : NULL;
+	SDL_FreeSurface(rendered);
+
+	SgGlyph glyph = { cp, -1, sg_rect(0, 0, 0, 0) };
+	if(s)
+	{
+		glyph.Rect.w = s->w;
+		glyph.Shelf = sg_glyph_shelf(atlas, s->w);
+		if(glyph.Shelf < 0)
+		{
+			SDL_FreeSurface(s);
+			glyph.Shelf = SG_GLYPH_RETRY;
+			atlas->CacheFullFrame = _sg_frame_number;
+		}
+	}
+
+	if(glyph.Shelf >= 0)
+	{
+		SgGlyphShelf *shelf = &atlas->CacheShelves[glyph.Shelf];
+		glyph.Rect = sg_rect(shelf->X, atlas->CacheTop + glyph.Shelf * atlas->LineHeight,
+			s->w, sg_min(s->h, atlas->LineHeight - 1));
+		shelf->X += s->w + 1;
+		shelf->LastUsed = _sg_frame_number;
+		sg_fontatlas_copy_alpha(atlas, s, sg_rect(0, 0, glyph.Rect.w, glyph.Rect.h),
+			glyph.Rect);
+		SDL_FreeSurface(s);
+
+		/* The padding is uploaded too, it may still hold an evicted glyph */
+		sg_fontatlas_touch(atlas, sg_rect(glyph.Rect.x, glyph.Rect.y,
+			sg_min(glyph.Rect.w + 1, atlas->Size.w - glyph.Rect.x), atlas->LineHeight));
+	}
+
+	/* Codepoints the font can not render are remembered as empty */
+	SgGlyph *slot = sg_glyph_slot(atlas, cp);
+	if(!slot->Codepoint)
+	{
+		if(glyph.Shelf < 0 && atlas->EmptyCount >= SG_GLYPH_EMPTY_MAX)
+		{
+			sg_glyph_rehash(atlas, atlas->GlyphCapacity, -1, false);
+			slot = sg_glyph_slot(atlas, cp);
+		}
+
+		if(2 * (atlas->GlyphCount + 1) > atlas->GlyphCapacity)
+		{
+			sg_glyph_rehash(atlas, 2 * atlas->GlyphCapacity, -1, true);
+			slot = sg_glyph_slot(atlas, cp);
+		}
+
+		++atlas->GlyphCount;
+	}
+	else if(slot->Shelf < 0)
+	{
+		--atlas->EmptyCount;
+	}
+
+	atlas->EmptyCount += (glyph.Shelf < 0);
+	*slot = glyph;
+	return glyph.Rect;
+}
+
+/* Bytes that are not valid UTF-8 are returned with this bit set */
+#define SG_UTF8_INVALID 0x80000000
+
+static uint32_t sg_utf8_next(const char **s, size_t avail)
+{
+	const uint8_t *p = (const uint8_t *)*s;
+	uint32_t c = p[0];
+	uint32_t cp = c;
+	size_t n = 0;
+	if(c >= 0xC0 && c < 0xE0)
+	{
+		n = 1;
+		cp = c & 0x1F;
+	}
+	else if(c >= 0xE0 && c < 0xF0)
+	{
+		n = 2;
+		cp = c & 0x0F;
+	}
+	else if(c >= 0xF0 && c < 0xF8)
+	{
+		n = 3;
+		cp = c & 0x07;
+	}
+	else if(c >= 0x80)
+	{
+		++*s;
+		return c | SG_UTF8_INVALID;
+	}
+
+	for(size_t i = 1; i <= n; ++i)
+	{
+		if(i >= avail || (p[i] & 0xC0) != 0x80)
+		{
+			++*s;
+			return c | SG_UTF8_INVALID;
+		}
+
+		cp = (cp << 6) | (p[i] & 0x3F);
+	}
+
+	*s += n + 1;
+	return cp;
+}
+
+/* ASCII and invalid bytes use the glyphs added by index if there are any,
+	everything else comes from the cache */
+static SgRect sg_glyph_rect(uint32_t cp)
+{
+	SgFontAtlas atlas = _sg_fontatlas;
+	if(cp & SG_UTF8_INVALID)
+	{
+		return atlas->CharRect[cp & 0xFF];
+	}
+
+	if(cp < 0x80 && atlas->CharRect[cp].w)
+	{
+		return atlas->CharRect[cp];
+	}
+
+	SgGlyph *glyph = sg_glyph_slot(atlas, cp);
+	if(!glyph->Codepoint ||
+		(glyph->Shelf == SG_GLYPH_RETRY && atlas->CacheFullFrame != _sg_frame_number))
+	{
+		return sg_glyph_add(atlas, cp);
+	}
+
+	if(glyph->Shelf >= 0)
+	{
+		atlas->CacheShelves[glyph->Shelf].LastUsed = _sg_frame_number;
+	}
+
+	return glyph->Rect;
+}
+
+static int sg_render_utf8(SgPoint p, const char *s, size_t len, SgColor color)
+{
+	int w = 0;
+	const char *end = s;
+	while(len && *s)
+	{
+		uint32_t cp = sg_utf8_next(&end, len);
+		len -= end - s;
+		s = end;
+		w += sg_render_glyph(sg_point(p.x + w, p.y), sg_glyph_rect(cp), color);
+	}
+
+	return w;
+}
+
+static int sg_utf8_width(const char *s, size_t len)
+{
+	int w = 0;
+	const char *end = s;
+	while(len && *s)
+	{
+		uint32_t cp = sg_utf8_next(&end, len);
+		len -= end - s;
+		s = end;
+		w += sg_glyph_rect(cp).w;
+	}
+
+	return w;
+}
+
+/* Printable ASCII comes from the cache when it was not added by index */
+static SgRect sg_char_rect(uint8_t c)
+{
+	SgRect r = _sg_fontatlas->CharRect[c];
+	if(!r.w && _sg_fontatlas->Font && c >= 32 && c < 0x7F)
+	{
+		r = sg_glyph_rect(c);
+	}
+
+	return r;
+}
+
+/* The character at byte i of text read through at, and the index after
+	it. Only with a glyph cache is UTF-8 decoded, otherwise every byte is
+	a character of the atlas. */
+static uint32_t sg_text_decode(char (*at)(void *, size_t), void *data,
+	size_t len, size_t i, size_t *next)
+{
+	uint8_t c = at(data, i);
+	if(c < 0x80 || !_sg_fontatlas->Font)
+	{
+		*next = i + 1;
+		return c;
+	}
+
+	char buf[4];
+	size_t n = sg_min_size(len - i, sizeof(buf));
+	for(size_t k = 0; k < n; ++k)
+	{
+		buf[k] = at(data, i + k);
+	}
+
+	const char *end = buf;
+	uint32_t cp = sg_utf8_next(&end, n);
+	*next = i + (end - buf);
+	return cp;
+}
+
+static SgRect sg_text_glyph(char (*at)(void *, size_t), void *data,
+	size_t len, size_t i, size_t *next)
+{
+	uint32_t cp = sg_text_decode(at, data, len, i, next);
+	return (cp < 0x80 || !_sg_fontatlas->Font) ? sg_char_rect(cp) : sg_glyph_rect(cp);
+}
+
+/* Moves i back to the start of the character it is in */
+static size_t sg_text_char_start(char (*at)(void *, size_t), void *data,
+	size_t len, size_t i)
+{
+	if(i >= len || !_sg_fontatlas->Font)
+	{
+		return i;
+	}
+
+	size_t start = i;
+	while(start > 0 && i - start < 3 && ((uint8_t)at(data, start) & 0xC0) == 0x80)
+	{
+		--start;
+	}
+
+	size_t next;
+	sg_text_decode(at, data, len, start, &next);
+	return (next > i) ? start : i;
+}
+
+int sg_render_char(SgPoint p, uint8_t c, SgColor color)
+{
+	return sg_render_glyph(p, sg_char_rect(c), color);
+}
+
+int sg_render_char_align(SgPoint p, uint8_t c, int flags, SgColor color)
+{
+	int valign = flags & SG_VALIGN_MASK;
+	int halign = flags & SG_HALIGN_MASK;
+
+	if(halign == SG_HALIGN_CENTER)
+	{
+		p.x -= sg_char_width(c) / 2;
+	}
+	else if(halign == SG_HALIGN_RIGHT)
+	{
+		p.x -= sg_char_width(c);
+	}
+
+	if(valign == SG_VALIGN_CENTER)
+	{
+		p.y -= sg_char_height(c) / 2;
+	}
+	else if(valign == SG_VALIGN_BOTTOM)
+	{
+		p.y -= sg_char_height(c);
+	}
+
+	return sg_render_char(p, c, color);
+}
+
+int sg_render_char_in_rect(SgRect d, uint8_t c, int flags, SgColor color)
+{
+	int valign = flags & SG_VALIGN_MASK;
+	int halign = flags & SG_HALIGN_MASK;
+
+	SgPoint r = { d.x, d.y };
+	if(halign == SG_HALIGN_CENTER)
+	{
+		r.x += d.w / 2 - sg_char_width(c) / 2;
+	}
+	else if(halign == SG_HALIGN_RIGHT)
+	{
+		r.x += d.w - sg_char_width(c);
+	}
+
+	if(valign == SG_VALIGN_CENTER)
+	{
+		r.y += d.h / 2 - sg_char_height(c) / 2;
+	}
+	else if(valign == SG_VALIGN_BOTTOM)
+	{
+		r.y += d.h - sg_char_height(c);
+	}
+
+	return sg_render_char(r, c, color);
+}
+
+int sg_render_string(SgPoint p, const char *s, SgColor color)
+{
+	if(_sg_fontatlas->Font)
+	{
+		return sg_render_utf8(p, s, SIZE_MAX, color);
+	}
+
+	int w = 0;
+	for(uint8_t c; (c = *s); ++s)
+	{
+		w += sg_render_char(sg_point(p.x + w, p.y), c, color);
+	}
+
+	return w;
+}
+
+/* The width is only known once the string is recorded, so the glyphs
+	are moved into place afterwards instead of measuring the string first.
+	With a clip rectangle the string is recorded unclipped and the glyphs
+	are clipped after moving them. */
+static int sg_render_string_halign(SgPoint p, const char *s, int halign, SgColor color)
+{
+	SgCommandList *list = &_sg_layers[_sg_layer];
+	int first = list->Count;
+	int clip_depth = _sg_clip_depth;
+	if(halign != SG_HALIGN_LEFT)
+	{
+		_sg_clip_depth = 0;
+	}
+
+	int w = sg_render_string(p, s, color);
+	_sg_clip_depth = clip_depth;
+
+	int dx = 0;
+	if(halign == SG_HALIGN_CENTER)
+	{
+		dx = -(w / 2);
+	}
+	else if(halign == SG_HALIGN_RIGHT)
+	{
+		dx = -w;
+	}
+
+	if(!dx)
+	{
+		return w;
+	}
+
+	int count = first;
+	for(int i = first; i < list->Count; ++i)
+	{
+		SgCommand cmd = list->Commands[i];
+		cmd.Dst.x += dx;
+		if(sg_clip(&cmd.Src, &cmd.Dst))
+		{
+			list->Commands[count++] = cmd;
+		}
+	}
+
+	/* The glyphs were all added to the last group */
+	int dropped = list->Count - count;
+	if(dropped)
+	{
+		SgCommandGroup *group = &_sg_groups.Groups[_sg_groups.Count - 1];
+		group->Count -= dropped;
+		if(!group->Count)
+		{
+			--_sg_groups.Count;
+			_sg_group_current = -1;
+		}
+
+		list->Count = count;
+		_sg_stats.Glyphs -= dropped;
+	}
+
+	return w;
+}
+
+int sg_render_string_align(SgPoint p, const char *s, int flags, SgColor color)
+{
+	int valign = flags & SG_VALIGN_MASK;
+	int halign = flags & SG_HALIGN_MASK;
+
+	if(valign == SG_VALIGN_CENTER)
+	{
+		p.y -= _sg_fontatlas->FontHeight / 2;
+	}
+	else if(valign == SG_VALIGN_BOTTOM)
+	{
+		p.y -= _sg_fontatlas->FontHeight;
+	}
+
+	return sg_render_string_halign(p, s, halign, color);
+}
+
+int sg_render_string_in_rect(SgRect d, const char *s, int flags, SgColor color)
+{
+	int valign = flags & SG_VALIGN_MASK;
+	int halign = flags & SG_HALIGN_MASK;
+
+	SgPoint r = { d.x, d.y };
+	if(halign == SG_HALIGN_CENTER)
+	{
+		r.x += d.w / 2;
+	}
+	else if(halign == SG_HALIGN_RIGHT)
+	{
+		r.x += d.w;
+	}
+
+	if(valign == SG_VALIGN_CENTER)
+	{
+		r.y += d.h / 2 - _sg_fontatlas->FontHeight / 2;
+	}
+	else if(valign == SG_VALIGN_BOTTOM)
+	{
+		r.y += d.h - _sg_fontatlas->FontHeight;
+	}
+
+	return sg_render_string_halign(r, s, halign, color);
+}
+
+int sg_render_string_len(SgPoint p, const char *s, size_t len, SgColor color)
+{
+	if(_sg_fontatlas->Font)
+	{
+		return sg_render_utf8(p, s, len, color);
+	}
+
+	int w = 0;
+	size_t i = 0;
+	for(uint8_t c; i < len && (c = s[i]); ++i)
+	{
+		w += sg_render_char(sg_point(p.x + w, p.y), c, color);
+	}
+
+	return w;
+}
+
+int sg_char_width(uint8_t c)
+{
+	return sg_char_rect(c).w;
+}
+
+int sg_char_height(uint8_t c)
+{
+	return sg_char_rect(c).h;
+}
+
+int sg_string_width(const char *s)
+{
+	if(_sg_fontatlas->Font)
+	{
+		return sg_utf8_width(s, SIZE_MAX);
+	}
+
+	int w = 0;
+	for(uint8_t c; (c = *s); ++s)
+	{
+		w += sg_char_width(c);
+	}
+
+	return w;
+}
+
+int sg_string_width_len(const char *s, size_t len)
+{
+	if(_sg_fontatlas->Font)
+	{
+		return sg_utf8_width(s, len);
+	}
+
+	int w = 0;
+	size_t i = 0;
+	for(uint8_t c; i < len && (c = s[i]); ++i)
+	{
+		w += sg_char_width(c);
+	}
+
+	return w;
+}
+
+/* ========================================================================== */
+/* allocation utils */
+static size_t _sg_alloc_count, _sg_free_count;
+
+void *sg_malloc(size_t size)
+{
+	void *p = malloc(size);
+	if(!p)
+	{
+		fprintf(stderr, "[sg_malloc] Memory allocation failed (%zu bytes)\n", size);
+		exit(1);
+	}
+
+	++_sg_alloc_count;
+	return p;
+}
+
+void *sg_calloc(size_t count, size_t size)
+{
+	void *ptr = calloc(count, size);
+	if(!ptr)
+	{
+		fprintf(stderr, "[sg_calloc] Memory allocation failed (%zu * %zu bytes)", count, size);
+		exit(1);
+	}
+
+	++_sg_alloc_count;
+	return ptr;
+}
+
+void *sg_realloc(void *p, size_t size)
+{
+	if(!p)
+	{
+		++_sg_alloc_count;
+	}
+
+	p = realloc(p, size);
+	if(!p)
+	{
+		fprintf(stderr, "[sg_realloc] Memory allocation failed (%zu bytes)", size);
+		exit(1);
+	}
+
+	return p;
+}
+
+void sg_free(void *p)
+{
+	if(p)
+	{
+		free(p);
+		++_sg_free_count;
+	}
+}
+
+void sg_alloc_report(void)
+{
+	printf("%zu allocs, %zu frees\n", _sg_alloc_count, _sg_free_count);
+}
+
+/* ========================================================================== */
+/* window */
+void sg_destroy(void)
+{
+	sg_commands_free();
+	sg_set_profiling(false);
+
+	sg_free(_sg_tb_offsets);
+	_sg_tb_offsets = NULL;
+	_sg_tb_offset_capacity = 0;
+	_sg_tb_measured = NULL;
+
+	sg_free(_sg_filter_index);
+	sg_free(_sg_filter_matches);
+	sg_string_buffer_free(&_sg_filter_query);
+	_sg_filter_items = NULL;
+	_sg_filter_index = NULL;
+	_sg_filter_matches = NULL;
+	_sg_filter_match_capacity = 0;
+
+	if(_sg_renderer)
+	{
+		SDL_DestroyRenderer(_sg_renderer);
+		_sg_renderer = NULL;
+	}
+
+	if(_sg_window)
+	{
+		SDL_DestroyWindow(_sg_window);
+		_sg_window = NULL;
+	}
+
+	if(SDL_WasInit(SDL_INIT_VIDEO))
+	{
+		SDL_Quit();
+	}
+
+	if(TTF_WasInit())
+	{
+		TTF_Quit();
+	}
+
+	sg_fontatlas_destroy(_sg_fontatlas_default);
+	sg_free(_sg_dirty_atlases);
+	_sg_dirty_atlases = NULL;
+	_sg_dirty_atlas_count = 0;
+	_sg_dirty_atlas_capacity = 0;
+
+	if(_sg_framebuffer)
+	{
+		SDL_FreeSurface(_sg_framebuffer);
+		_sg_framebuffer = NULL;
+	}
+
+	sg_free(_sg_key_pressed);
+	sg_free(_sg_key_released);
+}
+
+static void sg_init_common(void)
+{
+	if(TTF_Init())
+	{
+		printf("Loading initializing TTF: %s\n", TTF_GetError());
+		sg_destroy();
+		exit(1);
+	}
+
+	sg_state_invalidate();
+	SDL_SetRenderDrawBlendMode(_sg_renderer, SDL_BLENDMODE_NONE);
+
+	_sg_key_state = SDL_GetKeyboardState(&_sg_num_keys);
+	_sg_key_pressed = sg_calloc(_sg_num_keys, 1);
+	_sg_key_released = sg_calloc(_sg_num_keys, 1);
+
+	_sg_running = true;
+	_sg_wakeup_event = SDL_RegisterEvents(1);
+
+	_sg_fontatlas_default = sg_font_atlas_create(32, 16);
+	for(int c = 32; c <= 126; ++c)
+	{
+		sg_fontatlas_add_binary(_sg_fontatlas_default,
+			_sg_default_font + (c - 32) * 18,
+			sg_size(8, 18), c);
+	}
+
+	sg_fontatlas_add_default_icons(_sg_fontatlas_default);
+	sg_fontatlas_update(_sg_fontatlas_default);
+	_sg_fontatlas = _sg_fontatlas_default;
+}
+
+SgConfig sg_default_config(SgSize size, const char *title)
+{
+	SgConfig config =
+	{
+		.Size = size,
+		.Title = title,
+		.Headless = false,
+		.WindowFlags = SDL_WINDOW_RESIZABLE,
+		.RendererFlags = SDL_RENDERER_ACCELERATED,
+		.PresentMode = SG_PRESENT_VSYNC,
+		.TargetFps = 0
+	};
+
+	return config;
+}
+
+static void sg_init_window(const SgConfig *config)
+{
+	if(SDL_Init(SDL_INIT_VIDEO) < 0)
+	{
+		fprintf(stderr, "Error initializing SDL; SDL_Init: %s\n", SDL_GetError());
+		sg_destroy();
+		exit(1);
+	}
+
+	if(!(_sg_window = SDL_CreateWindow(config->Title ? config->Title : "",
+		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		config->Size.w, config->Size.h, config->WindowFlags)))
+	{
+		fprintf(stderr, "Error creating SDL_Window: %s\n", SDL_GetError());
+		sg_destroy();
+		exit(1);
+	}
+
+	uint32_t flags = config->RendererFlags;
+	if(config->PresentMode == SG_PRESENT_VSYNC)
+	{
+		flags |= SDL_RENDERER_PRESENTVSYNC;
+	}
+	else
+	{
+		flags &= ~SDL_RENDERER_PRESENTVSYNC;
+	}
+
+	if(!(_sg_renderer = SDL_CreateRenderer(_sg_window, -1, flags)))
+	{
+		fprintf(stderr, "Error creating SDL_Renderer: %s\n", SDL_GetError());
+		sg_destroy();
+		exit(1);
+	}
+}
+
+static void sg_init_offscreen(const SgConfig *config)
+{
+	/* An explicitly set SDL_VIDEODRIVER environment variable wins. The
+		hint of the same name is only read by SDL 2.0.22 and newer. */
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+	if(SDL_Init(SDL_INIT_VIDEO) < 0)
+	{
+		fprintf(stderr, "Error initializing SDL; SDL_Init: %s\n", SDL_GetError());
+		sg_destroy();
+		exit(1);
+	}
+
+	if(!(_sg_framebuffer = SDL_CreateRGBSurfaceWithFormat(0,
+		config->Size.w, config->Size.h, 32, SDL_PIXELFORMAT_ARGB8888)))
+	{
+		fprintf(stderr, "Error creating SDL_Surface: %s\n", SDL_GetError());
+		sg_destroy();
+		exit(1);
+	}
+
+	if(!(_sg_renderer = SDL_CreateSoftwareRenderer(_sg_framebuffer)))
+	{
+		fprintf(stderr, "Error creating SDL_Renderer: %s\n", SDL_GetError());
+		sg_destroy();
+		exit(1);
+	}
+}
+
+void sg_init_ex(const SgConfig *config)
+{
+	if(config->Headless)
+	{
+		sg_init_offscreen(config);
+	}
+	else
+	{
+		sg_init_window(config);
+	}
+
+	sg_init_common();
+	sg_set_target_fps(config->TargetFps);
+}
+
+void sg_init(SgSize size, const char *title)
+{
+	SgConfig config = sg_default_config(size, title);
+	sg_init_ex(&config);
+}
+
+void sg_init_headless(SgSize size)
+{
+	SgConfig config = sg_default_config(size, NULL);
+	config.Headless = true;
+	sg_init_ex(&config);
+}
+
+void sg_set_target_fps(int fps)
+{
+	_sg_frame_period = (fps > 0) ? SDL_GetPerformanceFrequency() / fps : 0;
+	_sg_frame_next = 0;
+}
+
+/* Sleeps until the next frame is due, if a target frame rate is set */
+static void sg_frame_limit(void)
+{
+	if(!_sg_frame_period)
+	{
+		return;
+	}
+
+	uint64_t now = SDL_GetPerformanceCounter();
+	if(!_sg_frame_next || now > _sg_frame_next + _sg_frame_period)
+	{
+		/* First frame, or too far behind to catch up */
+		_sg_frame_next = now + _sg_frame_period;
+		return;
+	}
+
+	if(now < _sg_frame_next)
+	{
+		uint64_t ms = (_sg_frame_next - now) * 1000 / SDL_GetPerformanceFrequency();
+		SDL_Delay(ms);
+	}
+
+	_sg_frame_next += _sg_frame_period;
+}
+
+SgSurface sg_get_framebuffer(void)
+{
+	return _sg_framebuffer;
+}
+
+int sg_save_framebuffer(const char *file)
+{
+	if(!_sg_framebuffer)
+	{
+		return 1;
+	}
+
+	return SDL_SaveBMP(_sg_framebuffer, file) != 0;
+}
+
+void sg_set_title(const char *title)
+{
+	if(_sg_window)
+	{
+		SDL_SetWindowTitle(_sg_window, title);
+	}
+}
+
+SgSize sg_get_window_size(void)
+{
+	SgSize size;
+	if(_sg_window)
+	{
+		SDL_GetWindowSize(_sg_window, &size.w, &size.h);
+	}
+	else
+	{
+		size = sg_size(_sg_framebuffer->w, _sg_framebuffer->h);
+	}
+
+	return size;
+}
+
+/* ========================================================================== */
+/* draw and fill rectangle */
+void sg_fill_rect(SgRect rect, SgColor color)
+{
+	if(rect.w <= 0 || rect.h <= 0 || !sg_clip(NULL, &rect))
+	{
+		return;
+	}
+
+	/* Drawn from the white block of the font atlas if possible,
+		so that rects and text end up in the same batch */
+	SgCommand *cmd;
+	if(_sg_fontatlas && _sg_fontatlas->Texture)
+	{
+		cmd = sg_command_push(SG_CMD_QUAD);
+		cmd->Texture = _sg_fontatlas->Texture;
+		cmd->Src = _sg_fontatlas->White;
+	}
+	else
+	{
+		cmd = sg_command_push(SG_CMD_RECT);
+	}
+
+	cmd->Dst = rect;
+	cmd->Color = color;
+	++_sg_stats.Rects;
+}
+
+void sg_draw_rect(SgRect rect, int border, SgColor color)
+{
+	sg_fill_rect(sg_rect(rect.x, rect.y, rect.w, border), color);
+	sg_fill_rect(sg_rect(rect.x, rect.y + rect.h - border, rect.w, border), color);
+
+	sg_fill_rect(sg_rect(rect.x, rect.y + border, border, rect.h - 2 * border), color);
+	sg_fill_rect(sg_rect(rect.x + rect.w - border, rect.y + border, border, rect.h - 2 * border), color);
+}
+
+/* ========================================================================== */
+/* textures */
+SgTexture sg_texture_load(const char *file)
+{
+	return IMG_LoadTexture(_sg_renderer, file);
+}
+
+void sg_texture_destroy(SgTexture texture)
+{
+	sg_commands_retarget(texture, NULL);
+	SDL_DestroyTexture(texture);
+
+	/* A new texture may get the same address */
+	_sg_force_present = true;
+}
+
+SgSize sg_texture_size(SgTexture texture)
+{
+	SgSize size;
+	SDL_QueryTexture(texture, NULL, NULL, &size.w, &size.h);
+	return size;
+}
+
+SgRect sg_texture_bounds(SgTexture texture)
+{
+	SgSize size = sg_texture_size(texture);
+	return sg_rect(0, 0, size.w, size.h);
+}
+
+void sg_texture_draw(SgTexture texture, SgRect src, SgRect dst)
+{
+	if(dst.w <= 0 || dst.h <= 0 || !sg_clip(&src, &dst))
+	{
+		return;
+	}
+
+	SgCommand *cmd = sg_command_push(SG_CMD_QUAD);
+	cmd->Texture = texture;
+	cmd->Src = src;
+	cmd->Dst = dst;
+	cmd->Color = SG_WHITE;
+}
+
+/* ========================================================================== */
+/* event handling */
+static void sg_handle_mouse_scroll(SDL_Event *e)
+{
+	_sg_scroll = sg_point(e->wheel.x, e->wheel.y);
+}
+
+static void sg_handle_mouse_button_down(SDL_Event *e)
+{
+	if(e->button.button == SDL_BUTTON_LEFT)
+	{
+		_sg_selected = false;
+
+		SgPoint click_point = sg_point(e->button.x, e->button.y);
+
+		uint32_t time = SDL_GetTicks();
+		if(time < sg_triple_click_time + sg_double_click_ms &&
+			sg_point_eq(sg_multi_click_point, click_point))
+		{
+			sg_double_click_time = 0;
+			sg_triple_click_time = 0;
+			sg_triple_click = true;
+		}
+		else if(time < sg_double_click_time + sg_double_click_ms &&
+			sg_point_eq(sg_multi_click_point, click_point))
+		{
+			sg_triple_click_time = sg_double_click_time;
+			sg_double_click_time = 0;
+			sg_double_click = true;
+		}
+		else
+		{
+			sg_double_click_time = time;
+			sg_multi_click_point = click_point;
+		}
+	}
+
+	_sg_mouse_button_pressed |= SDL_BUTTON(e->button.button);
+}
+
+static void sg_handle_mouse_button_up(SDL_Event *e)
+{
+	if(e->button.button == SDL_BUTTON_LEFT)
+	{
+		_sg_drag = false;
+		_sg_tb_multi_clicked = false;
+	}
+
+	_sg_mouse_button_released |= SDL_BUTTON(e->button.button);
+}
+
+static void sg_handle_key_down(SDL_Event *e)
+{
+	_sg_key_pressed[e->key.keysym.scancode] = 1;
+
+	if(_sg_keys_top < SG_MAX_KEYS)
+	{
+		int key = sg_key_convert(e->key.keysym.scancode, e->key.keysym.mod);
+		_sg_keys[_sg_keys_top++] = key;
+	}
+}
+
+static void sg_handle_key_up(SDL_Event *e)
+{
+	_sg_key_released[e->key.keysym.scancode] = 1;
+}
+
+static void sg_handle_event(SDL_Event *e)
+{
+	++_sg_frame_events;
+	switch(e->type)
+	{
+	case SDL_QUIT:
+		_sg_running = false;
+		break;
+
+	case SDL_WINDOWEVENT:
+		_sg_force_present = true;
+		break;
+
+	case SDL_MOUSEWHEEL:
+		sg_handle_mouse_scroll(e);
+		break;
+
+	case SDL_MOUSEBUTTONDOWN:
+		sg_handle_mouse_button_down(e);
+		break;
+
+	case SDL_MOUSEBUTTONUP:
+		sg_handle_mouse_button_up(e);
+		break;
+
+	case SDL_KEYDOWN:
+		sg_handle_key_down(e);
+		break;
+
+	case SDL_KEYUP:
+		sg_handle_key_up(e);
+		break;
+	}
+}
+
+void sg_begin(void)
+{
+	_sg_select_text = NULL;
+	_sg_overlay = _sg_overlay_next;
+	_sg_overlay_next = sg_rect(0, 0, 0, 0);
+
+	sg_double_click = false;
+	sg_triple_click = false;
+
+	_sg_keys_top = 0;
+	_sg_scroll = sg_point(0, 0);
+	_sg_mouse_button_pressed = 0;
+	_sg_mouse_button_released = 0;
+
+	memset(_sg_key_pressed, 0, _sg_num_keys);
+	memset(_sg_key_released, 0, _sg_num_keys);
+
+	/* Only block when the previous frame had no input and did not change
+		the picture, everything else may still be settling */
+	uint32_t deadline = _sg_frame_deadline;
+	bool wait = _sg_event_driven && _sg_frame_idle && !_sg_frame_events;
+	_sg_frame_deadline = 0;
+	_sg_frame_events = 0;
+
+	SDL_Event e;
+	if(wait)
+	{
+		int timeout = -1;
+		if(deadline)
+		{
+			uint32_t now = SDL_GetTicks();
+			timeout = SDL_TICKS_PASSED(now, deadline) ? 0 : (int)(deadline - now);
+		}
+
+		uint64_t blocked = SDL_GetPerformanceCounter();
+		if(SDL_WaitEventTimeout(&e, timeout))
+		{
+			sg_handle_event(&e);
+		}
+
+		/* Moving the frame start keeps the wait out of FrameMs */
+		if(_sg_time_frame)
+		{
+			_sg_time_frame += SDL_GetPerformanceCounter() - blocked;
+		}
+	}
+
+	/* Time spent blocked above is idle, not part of the frame */
+	uint64_t start = SDL_GetPerformanceCounter();
+	memset(&_sg_stats, 0, sizeof(_sg_stats));
+	++_sg_frame_number;
+	sg_zone_begin("frame");
+	sg_zone_begin("sg_begin");
+	while(SDL_PollEvent(&e))
+	{
+		sg_handle_event(&e);
+	}
+
+	sg_commands_reset();
+	_sg_clip_depth = 0;
+	_sg_clear_color = sg_theme->WindowBackgroundColor;
+
+	_sg_stats.Events = _sg_frame_events;
+	_sg_time_widgets = SDL_GetPerformanceCounter();
+	_sg_stats.BeginMs = sg_stats_ms(start, _sg_time_widgets);
+	sg_zone_end();
+}
+
+void sg_update(void)
+{
+	sg_select_render_dropdown();
+	_sg_stats.WidgetMs = sg_stats_ms(_sg_time_widgets, SDL_GetPerformanceCounter());
+	if(_sg_hud_enabled)
+	{
+		sg_hud_render();
+	}
+
+	uint64_t t0 = SDL_GetPerformanceCounter();
+	uint64_t t1 = t0;
+
+	/* Glyphs added to the caches while recording this frame */
+	for(int i = 0; i < _sg_dirty_atlas_count; ++i)
+	{
+		if(_sg_dirty_atlases[i]->DirtyCount)
+		{
+			sg_fontatlas_update(_sg_dirty_atlases[i]);
+		}
+	}
+
+	_sg_dirty_atlas_count = 0;
+
+	/* Skipping the present also skips the vsync wait,
+		so this is only done when sg_begin can block instead */
+	_sg_frame_idle = _sg_event_driven && !_sg_force_present &&
+		sg_commands_unchanged();
+	if(!_sg_frame_idle)
+	{
+		sg_zone_begin("sg_update");
+		sg_commands_submit();
+		if(_sg_hud_commands.Count)
+		{
+			sg_hud_submit();
+		}
+
+		sg_zone_end();
+		t1 = SDL_GetPerformanceCounter();
+		sg_zone_begin("SDL_RenderPresent");
+		SDL_RenderPresent(_sg_renderer);
+		sg_zone_end();
+		sg_commands_swap();
+		_sg_force_present = false;
+	}
+
+	_sg_upload_count = 0;
+
+	uint64_t t2 = SDL_GetPerformanceCounter();
+	_sg_stats.UpdateMs = sg_stats_ms(t0, t1);
+	_sg_stats.PresentMs = sg_stats_ms(t1, t2);
+
+	/* Closes the frame zone, and any zone left open by the application */
+	while(_sg_zone_depth)
+	{
+		sg_zone_end();
+	}
+
+	sg_frame_limit();
+
+	t2 = SDL_GetPerformanceCounter();
+	_sg_stats.FrameMs = _sg_time_frame ? sg_stats_ms(_sg_time_frame, t2) : 0;
+	_sg_time_frame = t2;
+	_sg_last_stats = _sg_stats;
+}
+
+/* ========================================================================== */
+/* idle handling */
+void sg_set_event_driven(bool enabled)
+{
+	_sg_event_driven = enabled;
+}
+
+void sg_request_frame(uint32_t ms)
+{
+	uint32_t t = SDL_GetTicks() + ms;
+	if(!t)
+	{
+		t = 1;
+	}
+
+	if(!_sg_frame_deadline || SDL_TICKS_PASSED(_sg_frame_deadline, t))
+	{
+		_sg_frame_deadline = t;
+	}
+}
+
+void sg_wakeup(void)
+{
+	if(_sg_wakeup_event == (uint32_t)-1)
+	{
+		return;
+	}
+
+	SDL_Event e;
+	memset(&e, 0, sizeof(e));
+	e.type = _sg_wakeup_event;
+	SDL_PushEvent(&e);
+}
+
+void sg_invalidate(void)
+{
+	_sg_force_present = true;
+}
+
+bool sg_running(void)
+{
+	return _sg_running;
+}
+
+/* ========================================================================== */
+/* mouse handling */
+bool sg_is_mouse_button_down(int button)
+{
+	return ((SDL_GetMouseState(NULL, NULL) & button) != 0) || sg_is_mouse_button_pressed(button);
+}
+
+bool sg_is_mouse_button_pressed(int button)
+{
+	return (_sg_mouse_button_pressed & button) != 0;
+}
+
+bool sg_is_mouse_button_released(int button)
+{
+	return (_sg_mouse_button_released & button) != 0;
+}
+
+SgPoint sg_mouse_position(void)
+{
+	int x, y;
+	SDL_GetMouseState(&x, &y);
+	return sg_point(x, y);
+}
+
+SgPoint sg_mouse_wheel(void)
+{
+	return _sg_scroll;
+}
+
+/* ========================================================================== */
+/* keyboard handling */
+bool sg_is_key_down(SDL_Scancode key)
+{
+	return _sg_key_state[key];
+}
+
+bool sg_is_key_pressed(SDL_Scancode key)
+{
+	return _sg_key_pressed[key];
+}
+
+bool sg_is_key_released(SDL_Scancode key)
+{
+	return _sg_key_released[key];
+}
+
+/* ========================================================================== */
+/* keyboard layouts */
+int sg_key_convert(int scancode, int mod)
+{
+	int key = scancode;
+	if(mod & (KMOD_LCTRL | KMOD_RCTRL))
+	{
+		key |= MOD_CTRL;
+	}
+
+	if(mod & KMOD_LALT)
+	{
+		key |= MOD_ALT;
+	}
+
+	if(mod & KMOD_RALT)
+	{
+		key |= MOD_ALT_GR;
+	}
+
+	if(mod & (KMOD_LGUI | KMOD_RGUI))
+	{
+		key |= MOD_OS;
+	}
+
+	if(mod & (KMOD_LSHIFT | KMOD_RSHIFT))
+	{
+		key |= MOD_SHIFT;
+	}
+
+	return key;
+}
+
+int sg_key_to_codepoint_german(int k)
+{
+	int nomods = k & 0xFF;
+
+	if(nomods == SDL_SCANCODE_TAB)                             { return '\t'; }
+	else if(nomods == SDL_SCANCODE_BACKSPACE)                  { return '\b'; }
+	else if(nomods == SDL_SCANCODE_RETURN)                     { return '\n'; }
+	else if(nomods == SDL_SCANCODE_SPACE)                      { return ' '; }
+	else if(k == (SDL_SCANCODE_COMMA | MOD_SHIFT))             { return ';'; }
+	else if(k == (SDL_SCANCODE_COMMA))                         { return ','; }
+	else if(k == (SDL_SCANCODE_PERIOD | MOD_SHIFT))            { return ':'; }
+	else if(k == (SDL_SCANCODE_PERIOD))                        { return '.'; }
+	else if(k == (SDL_SCANCODE_SLASH | MOD_SHIFT))             { return '_'; }
+	else if(k == (SDL_SCANCODE_SLASH))                         { return '-'; }
+	else if(k == (SDL_SCANCODE_BACKSLASH | MOD_SHIFT))         { return '\''; }
+	else if(k == (SDL_SCANCODE_BACKSLASH))                     { return '#'; }
+	else if(k == (SDL_SCANCODE_RIGHTBRACKET | MOD_SHIFT))      { return '*'; }
+	else if(k == (SDL_SCANCODE_RIGHTBRACKET | MOD_ALT_GR))     { return '~'; }
+	else if(k == (SDL_SCANCODE_RIGHTBRACKET))                  { return '+'; }
+	else if(k == (SDL_SCANCODE_NONUSBACKSLASH | MOD_SHIFT))    { return '>'; }
+	else if(k == (SDL_SCANCODE_NONUSBACKSLASH | MOD_ALT_GR))   { return '|'; }
+	else if(k == SDL_SCANCODE_NONUSBACKSLASH)                  { return '<'; }
+	else if(k == (SDL_SCANCODE_MINUS | MOD_SHIFT))             { return '?'; }
+	else if(k == (SDL_SCANCODE_MINUS | MOD_ALT_GR))            { return '\\'; }
+	else if(k == (SDL_SCANCODE_EQUALS | MOD_SHIFT))            { return '`'; }
+	else if(k == SDL_SCANCODE_GRAVE)                           { return '^'; }
+	else if(nomods >= SDL_SCANCODE_A && nomods <= SDL_SCANCODE_Z)
+	{
+		int c = nomods - SDL_SCANCODE_A + 'a';
+
+		if(c == 'z') { c = 'y'; }
+		else if(c == 'y') { c = 'z'; }
+
+		if(k & MOD_ALT_GR)
+		{
+			if(c == 'q') { return '@'; }
+		}
+
+		if(k & MOD_SHIFT)
+		{
+			c = toupper(c);
+		}
+
+		return c;
+	}
+	else if(nomods >= SDL_SCANCODE_1 && nomods <= SDL_SCANCODE_0)
+	{
+		static const uint8_t numbers[] =
+			{ '1', '2', '3', '4', '5', '6', '7', '8', '9', '0' };
+
+		static const uint8_t numbers_shift[] =
+			{ '!', '\"', 0, '$', '%', '&', '/', '(', ')', '=' };
+
+		static const uint8_t numbers_altgr[] =
+			{ 0, 0, 0, 0, 0, 0, '{', '[', ']', '}' };
+
+		int idx = nomods - SDL_SCANCODE_1;
+
+		if(k & MOD_SHIFT)
+		{
+			return numbers_shift[idx];
+		}
+		else if(k & MOD_ALT_GR)
+		{
+			return numbers_altgr[idx];
+		}
+		else
+		{
+			return numbers[idx];
+		}
+	}
+
+	return 0;
+}
+
+/* ========================================================================== */
+/* GUI GLOBAL STATE */
+
+SgTheme sg_default_theme =
+{
+	/* Window */
+	.WindowBackgroundColor = 0x100000,
+
+	/* Label */
+	.LabelTextColor = 0xff8200,
+
+	/* Button */
+	.ButtonTextColor = { 0xff8200, 0xff8200, 0xff8200 },
+	.ButtonInnerColor = { 0x310000, 0x7b0000, 0x510000 },
+	.ButtonBorderColor = { 0x7b0000, 0xff8200, 0xff8200 },
+	.ButtonBorderThickness = { 2, 2, 1 },
+
+	/* Checkbox */
+	.CheckboxIconColor = { 0xff8200, 0xff8200, 0xff8200 },
+	.CheckboxInnerColor = { 0x310000, 0x7b0000, 0x510000 },
+	.CheckboxBorderColor = { 0x7b0000, 0xff8200, 0xff8200 },
+	.CheckboxBorderThickness = { 2, 2, 1 },
+
+	/* Textbox */
+	.TextboxTextColor = { 0xff8200, 0xff8200, 0xff8200 },
+	.TextboxInnerColor = { 0x310000, 0x7b0000, 0x510000 },
+	.TextboxBorderColor = { 0x7b0000, 0xff8200, 0xff8200 },
+	.TextboxBorderThickness = { 2, 2, 1 },
+	.TextboxPaddingX = 5,
+	.Cursor = { 0, 0, 2, 0 },
+	.CursorColor = 0xff8200,
+	.CursorBlinkMs = 0,
+	.SelectionColor = 0xff8200,
+	.SelectionTextColor = 0x310000,
+
+	/* Slider */
+	.SliderThumbColor = { 0x7b0000, 0xff8200, 0xffb200 },
+	.SliderRailColor = { 0x510000, 0x7b0000, 0x9b0000 },
+	.SliderThumbWidth = 6,
+	.SliderRailHeight = 6,
+
+	/* Select */
+	.SelectTextColor = { 0xff8200, 0xff8200, 0xff8200 },
+	.SelectInnerColor = { 0x310000, 0x7b0000, 0x510000 },
+	.SelectBorderColor = { 0x7b0000, 0xff8200, 0xff8200 },
+	.SelectBorderThickness = { 2, 2, 1 },
+	.SelectPageBorderColor = 0x333333,
+	.SelectPageBorderThickness = 1,
+	.SelectItemInnerColor = { 0xFFFFFF, 0x3399ff },
+	.SelectItemTextColor = { 0x000000, 0xFFFFFF },
+	.SelectItemPadding = 3,
+	.SelectPageItems = 5,
+	.SelectPaddingX = 10,
+	.SelectScrollbarWidth = 8,
+	.SelectScrollbarColor = 0xAAAAAA,
+
+	/* Table */
+	.TableTextColor = 0xff8200,
+	.TableRowColor = { 0x310000, 0x3d0000 },
+	.TableHeaderColor = 0x7b0000,
+	.TableHeaderTextColor = 0xff8200,
+	.TableSelectedColor = 0x9b0000,
+	.TableBorderColor = 0x7b0000,
+	.TableBorderThickness = 2,
+	.TableRowHeight = 24,
+	.TablePaddingX = 6,
+	.TableScrollbarWidth = 8,
+	.TableScrollbarColor = 0xAAAAAA,
+};
+
+SgTheme *sg_theme = &sg_default_theme;
+
+/* ========================================================================== */
+/* sg_color */
+SgColor sg_color(int r, int g, int b)
+{
+	return (r << 16) | (g << 8) | b;
+}
+
+/* ========================================================================== */
+/* sg_rect */
+bool sg_rect_contains_point(SgRect rect, SgPoint p)
+{
+	return p.x >= rect.x && p.y >= rect.y &&
+		p.x < rect.x + rect.w && p.y < rect.y + rect.h;
+}
+
+bool sg_rect_contains_mouse(SgRect rect)
+{
+	SgPoint m = sg_mouse_position();
+	return sg_rect_contains_point(rect, m) && !sg_rect_contains_point(_sg_overlay, m);
+}
+
+/* ========================================================================== */
+/* common functions for controls */
+void sg_border_rect(SgRect d, SgColor inner, SgColor border, int thickness)
+{
+	SgRect inner_rect =
+	{
+		d.x + thickness,
+		d.y + thickness,
+		d.w - 2 * thickness,
+		d.h - 2 * thickness
+	};
+
+	sg_fill_rect(inner_rect, inner);
+	sg_draw_rect(d, thickness, border);
+}
+
+void sg_box(SgRect d, int index, SgColor *inner_color,
+	SgColor *border_color, int *border_thickness)
+{
+	sg_border_rect(d, inner_color[index],
+		border_color[index], border_thickness[index]);
+}
+
+bool sg_clicked(SgRect d, int *index)
+{
+	bool hover = sg_rect_contains_mouse(d);
+	bool active = sg_is_mouse_button_down(SG_BUTTON_LEFT);
+	*index = (hover ? (active ? SG_INDEX_ACTIVE : SG_INDEX_HOVER) : SG_INDEX_DEFAULT);
+	return hover && sg_is_mouse_button_pressed(SG_BUTTON_LEFT);
+}
+
+bool sg_selected(SgRect d, int *index, bool *state)
+{
+	bool hover = sg_rect_contains_mouse(d);
+	if(hover && sg_is_mouse_button_down(SG_BUTTON_LEFT))
+	{
+		*state = true;
+		_sg_selected_point = sg_mouse_position();
+	}
+
+	bool sel = *state && sg_rect_contains_point(d, _sg_selected_point);
+	*index = sel ? SG_INDEX_ACTIVE : (hover ? SG_INDEX_HOVER : SG_INDEX_DEFAULT);
+	return sel;
+}
+
+/* ========================================================================== */
+/* sg_label */
+void sg_label(SgRect d, const char *text, int flags)
+{
+	sg_zone_begin("sg_label");
+	sg_widget_begin();
+	sg_render_string_in_rect(d, text, flags, sg_theme->LabelTextColor);
+	sg_widget_end();
+	sg_zone_end();
+}
+
+/* ========================================================================== */
+/* sg_button */
+bool sg_button(SgRect d, const char *text)
+{
+	sg_zone_begin("sg_button");
+	sg_widget_begin();
+	int index;
+	bool clicked = sg_clicked(d, &index);
+
+	sg_box(d, index, sg_theme->ButtonInnerColor,
+		sg_theme->ButtonBorderColor, sg_theme->ButtonBorderThickness);
+	sg_render_string_in_rect(d, text, SG_CENTER, sg_theme->ButtonTextColor[index]);
+	sg_widget_end();
+	sg_zone_end();
+
+	return clicked;
+}
+
+/* ========================================================================== */
+/* sg_checkbox */
+void sg_set_checkmark_char(uint8_t index)
+{
+	_sg_char_checkmark = index;
+}
+
+uint8_t sg_get_checkmark_char(void)
+{
+	return sg_char_width(_sg_char_checkmark) > 0 ? _sg_char_checkmark : 'X';
+}
+
+bool sg_checkbox(SgRect d, bool *checked)
+{
+	sg_zone_begin("sg_checkbox");
+	sg_widget_begin();
+	int index;
+	bool clicked = sg_clicked(d, &index);
+
+	sg_box(d, index, sg_theme->CheckboxInnerColor,
+		sg_theme->CheckboxBorderColor, sg_theme->CheckboxBorderThickness);
+	if(*checked)
+	{
+		sg_render_char_in_rect(d, sg_get_checkmark_char(),
+			SG_CENTER, sg_theme->CheckboxIconColor[index]);
+	}
+
+	sg_widget_end();
+	sg_zone_end();
+
+	if(clicked)
+	{
+		*checked = !*checked;
+	}
+
+	return clicked;
+}
+
+/* ========================================================================== */
+/* sg_slider */
+int sg_slider(SgRect d, double *value, double min, double max)
+{
+	sg_zone_begin("sg_slider");
+	sg_widget_begin();
+	int index;
+	bool active = sg_selected(d, &index, &_sg_drag);
+
+	sg_fill_rect(sg_rect(d.x, d.y + d.h / 2 - sg_theme->SliderRailHeight / 2, d.w, sg_theme->SliderRailHeight),
+		sg_theme->SliderRailColor[index]);
+
+	int thumb_pos = d.x + (*value - min) / (max - min) * (d.w - sg_theme->SliderThumbWidth);
+	sg_fill_rect(sg_rect(thumb_pos, d.y, sg_theme->SliderThumbWidth, d.h),
+		sg_theme->SliderThumbColor[index]);
+	sg_widget_end();
+	sg_zone_end();
+
+	double prev_value = *value;
+	if(active)
+	{
+		SgPoint mouse = sg_mouse_position();
+		double percent = (mouse.x - (d.x + sg_theme->SliderThumbWidth / 2)) /
+			(double)(d.w - sg_theme->SliderThumbWidth);
+		*value = min + sg_fclamp(percent, 0.0, 1.0) * (max - min);
+	}
+
+	return *value != prev_value;
+}
+
+/* ========================================================================== */
+/* sg_select */
+void sg_set_select_char(uint8_t index)
+{
+	_sg_char_select = index;
+}
+
+uint8_t sg_get_select_char(void)
+{
+	return sg_char_width(_sg_char_select) > 0 ? _sg_char_select : 'V';
+}
+
+bool sg_select_selected(SgRect d, int *index)
+{
+	bool hover = sg_rect_contains_mouse(d);
+	bool click = hover && sg_is_mouse_button_pressed(SG_BUTTON_LEFT);
+
+	bool sel = _sg_select_selected && sg_rect_contains_point(d, _sg_selected_point);
+	if(sel && click)
+	{
+		_sg_select_selected = false;
+	}
+	else if(click)
+	{
+		_sg_select_selected = !_sg_select_selected;
+		_sg_selected_point = sg_mouse_position();
+		sel = _sg_select_selected;
+	}
+
+	*index = sel ? SG_INDEX_ACTIVE : (hover ? SG_INDEX_HOVER : SG_INDEX_DEFAULT);
+	return sel;
+}
+
+/* Thumb of a scrollbar track that shows visible of count rows from start */
+static SgRect sg_scrollbar_thumb(SgRect track, size_t count, size_t visible, size_t start)
+{
+	size_t max = count - visible;
+	int h = sg_max((int)((double)track.h * visible / count), track.w);
+	int y = (int)((double)start / max * (track.h - h));
+	return sg_rect(track.x, track.y + y, track.w, h);
+}
+
+/* First row when the top of the thumb is dragged to y */
+static size_t sg_scrollbar_drag(SgRect track, SgRect thumb, size_t max, int y)
+{
+	if(track.h <= thumb.h)
+	{
+		return 0;
+	}
+
+	double t = (double)(y - track.y) / (track.h - thumb.h);
+	return (t <= 0) ? 0 : (t >= 1) ? max : (size_t)(t * max + 0.5);
+}
+
+/* Moves start by three rows per mouse wheel step */
+static size_t sg_scroll_wheel(size_t start)
+{
+	int wheel = -3 * sg_mouse_wheel().y;
+	return (wheel < 0 && (size_t)-wheel > start) ? 0 : start + wheel;
+}
+
+/* Geometry of the dropdown below a select d */
+typedef struct
+{
+	SgRect Page;
+	SgRect Track;
+	SgRect Thumb;
+	int RowsY;
+	int Rows;
+} SgSelectPage;
+
+static SgSelectPage sg_select_page(SgRect d, size_t count, size_t start)
+{
+	SgSelectPage page;
+	int border = sg_theme->SelectPageBorderThickness;
+	int padding = sg_theme->SelectItemPadding;
+	page.Rows = (count < (size_t)sg_theme->SelectPageItems) ?
+		(int)count : sg_theme->SelectPageItems;
+	page.Page = sg_rect(d.x, d.y + d.h, d.w,
+		page.Rows * (d.h - padding) + 2 * border + (page.Rows + 1) * padding);
+	page.RowsY = page.Page.y + border + padding;
+
+	page.Track = sg_rect(0, 0, 0, 0);
+	page.Thumb = page.Track;
+	if(count > (size_t)page.Rows && sg_theme->SelectScrollbarWidth > 0)
+	{
+		int w = sg_theme->SelectScrollbarWidth;
+		page.Track = sg_rect(page.Page.x + page.Page.w - border - w,
+			page.Page.y + border, w, page.Page.h - 2 * border);
+		page.Thumb = sg_scrollbar_thumb(page.Track, count, page.Rows, start);
+	}
+
+	return page;
+}
+
+/* Row of the page under the mouse, or -1 */
+static int sg_select_row(SgRect d, const SgSelectPage *page)
+{
+	SgPoint m = sg_mouse_position();
+	if(!sg_rect_contains_point(page->Page, m) ||
+		sg_rect_contains_point(page->Track, m) || m.y < page->RowsY)
+	{
+		return -1;
+	}
+
+	int row = (m.y - page->RowsY) / d.h;
+	return row < page->Rows ? row : -1;
+}
+
+void sg_select_render_dropdown(void)
+{
+	if(!_sg_select_text)
+	{
+		return;
+	}
+
+	sg_zone_begin("sg_select_render_dropdown");
+	sg_widget_begin();
+	sg_set_layer(SG_LAYER_OVERLAY);
+
+	SgRect d = _sg_select_dim;
+	size_t cur = _sg_select_item_cur;
+	size_t start = _sg_select_item_start;
+	SgSelectPage page = sg_select_page(d, _sg_select_item_count, start);
+
+	sg_border_rect(page.Page,
+		sg_theme->SelectItemInnerColor[SG_INDEX_DEFAULT],
+		sg_theme->SelectPageBorderColor,
+		sg_theme->SelectPageBorderThickness);
+
+	SgRect b = sg_rect(
+		d.x + sg_theme->SelectItemPadding + sg_theme->SelectPageBorderThickness,
+		page.RowsY,
+		d.w - 2 * (sg_theme->SelectItemPadding + sg_theme->SelectPageBorderThickness) - page.Track.w,
+		d.h - sg_theme->SelectItemPadding);
+
+	/* Only the visible rows are drawn, whatever the item count */
+	int hover = sg_select_row(d, &page);
+	for(int i = 0; i < page.Rows; ++i, b.y += d.h)
+	{
+		bool highlight = (hover >= 0) ? (i == hover) : (start + i == cur);
+		if(highlight)
+		{
+			sg_fill_rect(b, sg_theme->SelectItemInnerColor[SG_INDEX_HOVER]);
+		}
+
+		sg_push_clip(b);
+		sg_render_string_in_rect(
+			sg_rect(d.x + sg_theme->SelectPaddingX, b.y, b.w, b.h),
+			_sg_select_text(start + i), SG_CENTER_LEFT,
+			sg_theme->SelectTextColor[highlight ? SG_INDEX_HOVER : SG_INDEX_DEFAULT]);
+		sg_pop_clip();
+	}
+
+	if(page.Track.w)
+	{
+		sg_fill_rect(page.Thumb, sg_theme->SelectScrollbarColor);
+	}
+
+	sg_set_layer(SG_LAYER_BASE);
+	sg_widget_end();
+	sg_zone_end();
+}
+
+/* Scrolling and picking rows of the open dropdown,
+	returns true when a row was picked */
+static bool sg_select_page_input(SgRect d, size_t count, size_t *picked)
+{
+	SgPoint m = sg_mouse_position();
+	size_t start = _sg_select_item_start;
+	SgSelectPage page = sg_select_page(d, count, start);
+	size_t max = count - page.Rows;
+	bool pressed = sg_is_mouse_button_pressed(SG_BUTTON_LEFT);
+
+	if(sg_rect_contains_point(page.Page, m))
+	{
+		start = sg_scroll_wheel(start);
+	}
+
+	if(pressed && sg_rect_contains_point(page.Track, m))
+	{
+		_sg_select_scrolling = true;
+		_sg_select_grab = sg_rect_contains_point(page.Thumb, m) ?
+			m.y - page.Thumb.y : page.Thumb.h / 2;
+	}
+
+	if(_sg_select_scrolling)
+	{
+		if(!sg_is_mouse_button_down(SG_BUTTON_LEFT))
+		{
+			_sg_select_scrolling = false;
+		}
+		else
+		{
+			start = sg_scrollbar_drag(page.Track, page.Thumb, max, m.y - _sg_select_grab);
+		}
+	}
+
+	_sg_select_item_start = (start < max) ? start : max;
+
+	int row = sg_select_row(d, &page);
+	if(pressed && row >= 0)
+	{
+		*picked = _sg_select_item_start + row;
+		_sg_select_selected = false;
+		return true;
+	}
+
+	if(pressed && !_sg_select_scrolling && !sg_rect_contains_point(page.Page, m) &&
+		!sg_rect_contains_point(d, m))
+	{
+		_sg_select_selected = false;
+	}
+
+	return false;
+}
+
+/* Opening, scrolling and picking of a select with count items,
+	returns whether the dropdown is open */
+static bool sg_select_input(SgRect d, size_t count, size_t *current,
+	int *index, int *changed)
+{
+	bool opened = !_sg_select_selected;
+	if(!sg_select_selected(d, index))
+	{
+		return false;
+	}
+
+	if(opened)
+	{
+		/* Start with the current item in view */
+		size_t rows = sg_select_page(d, count, 0).Rows;
+		_sg_select_item_start = (*current > rows / 2) ? *current - rows / 2 : 0;
+		_sg_select_scrolling = false;
+	}
+
+	*changed = sg_select_page_input(d, count, current);
+	if(!_sg_select_selected)
+	{
+		*index = sg_rect_contains_mouse(d) ? SG_INDEX_HOVER : SG_INDEX_DEFAULT;
+	}
+
+	return _sg_select_selected;
+}
+
+static const char *sg_select_item_text(size_t row)
+{
+	return _sg_select_items[row];
+}
+
+/* Draws the select box with len bytes of text,
+	and a cursor before text[caret] unless caret is negative */
+static void sg_select_box(SgRect d, int index, const char *text, size_t len,
+	int caret)
+{
+	sg_box(d, index, sg_theme->SelectInnerColor,
+		sg_theme->SelectBorderColor, sg_theme->SelectBorderThickness);
+
+	SgColor color = sg_theme->SelectTextColor[index];
+	SgPoint p = sg_point(d.x + sg_theme->SelectPaddingX,
+		d.y + d.h / 2 - _sg_fontatlas->FontHeight / 2);
+
+	int arrow = sg_char_width(sg_get_select_char());
+	sg_push_clip(sg_rect(d.x, d.y, d.w - 2 * sg_theme->SelectPaddingX - arrow, d.h));
+	sg_render_string_len(p, text, len, color);
+	if(caret >= 0)
+	{
+		sg_fill_rect(sg_rect(p.x + sg_theme->Cursor.x +
+			sg_string_width_len(text, caret),
+			p.y + sg_theme->Cursor.y, sg_theme->Cursor.w,
+			_sg_fontatlas->FontHeight + sg_theme->Cursor.h),
+			sg_theme->CursorColor);
+	}
+
+	sg_pop_clip();
+
+	sg_render_char_align(
+		sg_point(d.x + d.w - sg_theme->SelectPaddingX, d.y + d.h / 2),
+		sg_get_select_char(), SG_CENTER_RIGHT, color);
+}
+
+/* Publishes the open dropdown for sg_select_render_dropdown */
+static void sg_select_open(SgRect d, const char *(*text)(size_t row),
+	size_t count, size_t cur)
+{
+	_sg_select_text = text;
+	_sg_select_item_count = count;
+	_sg_select_item_cur = cur;
+	_sg_select_dim = d;
+	_sg_overlay_next = sg_select_page(d, count, _sg_select_item_start).Page;
+}
+
+int sg_select(SgRect d, const char *items[], size_t count, size_t *current)
+{
+	sg_zone_begin("sg_select");
+	sg_widget_begin();
+	assert(count > 0);
+
+	int index;
+	int changed = 0;
+	bool selected = sg_select_input(d, count, current, &index, &changed);
+
+	sg_select_box(d, index, items[*current], strlen(items[*current]), -1);
+	sg_widget_end();
+	sg_zone_end();
+
+	if(selected)
+	{
+		_sg_select_items = items;
+		sg_select_open(d, sg_select_item_text, count, *current);
+	}
+
+	return changed;
+}
+
+/* Asks provider for one item, the text is valid until the next call */
+static const char *sg_select_provide(SgSelectProvider provider, void *userdata, size_t row)
+{
+	_sg_select_buf[0] = '\0';
+	provider(row, _sg_select_buf, sizeof(_sg_select_buf), userdata);
+	_sg_select_buf[sizeof(_sg_select_buf) - 1] = '\0';
+	return _sg_select_buf;
+}
+
+/* Row text of the open dropdown */
+static const char *sg_select_provider_text(size_t row)
+{
+	return sg_select_provide(_sg_select_provider, _sg_select_userdata, row);
+}
+
+int sg_select_provider(SgRect d, SgSelectProvider provider, void *userdata,
+	size_t count, size_t *current)
+{
+	sg_zone_begin("sg_select_provider");
+	sg_widget_begin();
+	assert(count > 0);
+
+	int index;
+	int changed = 0;
+	bool selected = sg_select_input(d, count, current, &index, &changed);
+
+	const char *text = sg_select_provide(provider, userdata, *current);
+	sg_select_box(d, index, text, strlen(text), -1);
+	sg_widget_end();
+	sg_zone_end();
+
+	if(selected)
+	{
+		_sg_select_provider = provider;
+		_sg_select_userdata = userdata;
+		sg_select_open(d, sg_select_provider_text, count, *current);
+	}
+
+	return changed;
+}
+
+/* ========================================================================== */
+/* sg_table */
+static SgTable *_sg_table_scrolling;
+static int _sg_table_grab;
+
+/* Fixed height rows make hit testing a division, and only the
+	visible rows and columns are asked for their text */
+int sg_table(SgRect d, SgTable *t)
+{
+	sg_zone_begin("sg_table");
+	sg_widget_begin();
+	int border = sg_theme->TableBorderThickness;
+	int pad = sg_theme->TablePaddingX;
+	int row_h = sg_max(sg_theme->TableRowHeight, 1);
+	int header_h = t->Titles ? row_h : 0;
+	SgRect inner = sg_rect(d.x + border, d.y + border,
+		d.w - 2 * border, d.h - 2 * border);
+	size_t visible = sg_max((inner.h - header_h) / row_h, 1);
+	size_t max = (t->RowCount > visible) ? t->RowCount - visible : 0;
+
+	SgRect track = sg_rect(0, 0, 0, 0);
+	if(max > 0 && sg_theme->TableScrollbarWidth > 0)
+	{
+		int w = sg_theme->TableScrollbarWidth;
+		track = sg_rect(inner.x + inner.w - w, inner.y + header_h,
+			w, inner.h - header_h);
+	}
+
+	SgRect body = sg_rect(inner.x, inner.y + header_h,
+		inner.w - track.w, inner.h - header_h);
+
+	int total_w = 0;
+	for(size_t c = 0; c < t->ColumnCount; ++c)
+	{
+		total_w += t->ColumnWidths[c];
+	}
+
+	SgPoint m = sg_mouse_position();
+	bool hover = sg_rect_contains_mouse(d);
+	bool pressed = hover && sg_is_mouse_button_pressed(SG_BUTTON_LEFT);
+	int changed = 0;
+	if(hover)
+	{
+		t->ScrollRow = sg_scroll_wheel(t->ScrollRow);
+		t->ScrollX += 3 * row_h * sg_mouse_wheel().x;
+	}
+
+	t->ScrollRow = (t->ScrollRow < max) ? t->ScrollRow : max;
+	SgRect thumb = track.w ?
+		sg_scrollbar_thumb(track, t->RowCount, visible, t->ScrollRow) : track;
+
+	if(pressed && sg_rect_contains_point(track, m))
+	{
+		_sg_table_scrolling = t;
+		_sg_table_grab = sg_rect_contains_point(thumb, m) ?
+			m.y - thumb.y : thumb.h / 2;
+	}
+
+	if(_sg_table_scrolling == t)
+	{
+		if(!sg_is_mouse_button_down(SG_BUTTON_LEFT))
+		{
+			_sg_table_scrolling = NULL;
+		}
+		else
+		{
+			t->ScrollRow = sg_scrollbar_drag(track, thumb, max, m.y - _sg_table_grab);
+			thumb = sg_scrollbar_thumb(track, t->RowCount, visible, t->ScrollRow);
+		}
+	}
+	else if(pressed && sg_rect_contains_point(body, m))
+	{
+		size_t row = t->ScrollRow + (m.y - body.y) / row_h;
+		if(row < t->RowCount)
+		{
+			t->Selected = row;
+			changed = 1;
+		}
+	}
+
+	t->ScrollX = sg_max(0, sg_min(t->ScrollX, total_w - body.w));
+
+	sg_border_rect(d, sg_theme->TableRowColor[0],
+		sg_theme->TableBorderColor, border);
+
+	sg_push_clip(inner);
+
+	/* All backgrounds first, then the text column by column,
+		so that the commands of each kind batch together */
+	size_t first = t->ScrollRow;
+	size_t last = first + visible + 1;
+	if(last > t->RowCount)
+	{
+		last = t->RowCount;
+	}
+
+	for(size_t r = first; r < last; ++r)
+	{
+		SgRect row = sg_rect(body.x, body.y + (int)(r - first) * row_h, body.w, row_h);
+		if(r == t->Selected)
+		{
+			sg_fill_rect(row, sg_theme->TableSelectedColor);
+		}
+		else if(r % 2)
+		{
+			sg_fill_rect(row, sg_theme->TableRowColor[1]);
+		}
+	}
+
+	if(header_h)
+	{
+		sg_fill_rect(sg_rect(inner.x, inner.y, inner.w, header_h),
+			sg_theme->TableHeaderColor);
+	}
+
+	if(track.w)
+	{
+		sg_fill_rect(thumb, sg_theme->TableScrollbarColor);
+	}
+
+	char buf[256];
+	int text_y = (row_h - _sg_fontatlas->FontHeight) / 2;
+	int right = body.x + body.w;
+	int x = body.x - t->ScrollX;
+	for(size_t c = 0; c < t->ColumnCount && x < right; x += t->ColumnWidths[c++])
+	{
+		int w = t->ColumnWidths[c];
+		if(x + w <= body.x)
+		{
+			continue;
+		}
+
+		if(header_h)
+		{
+			sg_push_clip(sg_rect(x + pad, inner.y, w - 2 * pad, header_h));
+			sg_render_string(sg_point(x + pad, inner.y + text_y),
+				t->Titles[c], sg_theme->TableHeaderTextColor);
+			sg_pop_clip();
+		}
+
+		sg_push_clip(sg_rect(x + pad, body.y, w - 2 * pad, body.h));
+		for(size_t r = first; r < last; ++r)
+		{
+			buf[0] = '\0';
+			t->Cell(r, c, buf, sizeof(buf), t->UserData);
+			buf[sizeof(buf) - 1] = '\0';
+			sg_render_string(sg_point(x + pad, body.y + (int)(r - first) * row_h + text_y),
+				buf, sg_theme->TableTextColor);
+		}
+
+		sg_pop_clip();
+	}
+
+	sg_pop_clip();
+	sg_widget_end();
+	sg_zone_end();
+	return changed;
+}
+
+/* ========================================================================== */
+/* string buffer */
+
+/* Owned buffers are gap buffers: the unused capacity sits at gap,
+	which moves to wherever the text is edited. Fixed buffers
+	supplied by the application keep it at the end */
+static inline char sg_string_buffer_at(const SgStringBuffer *sb, size_t i)
+{
+	return (sb->owned && i >= sb->gap) ?
+		sb->buffer[i + sb->capacity - sb->length] : sb->buffer[i];
+}
+
+static void sg_string_buffer_move_gap(SgStringBuffer *sb, size_t pos)
+{
+	size_t gap_len = sb->capacity - sb->length;
+	if(pos < sb->gap)
+	{
+		memmove(sb->buffer + pos + gap_len, sb->buffer + pos, sb->gap - pos);
+	}
+	else if(pos > sb->gap)
+	{
+		memmove(sb->buffer + sb->gap, sb->buffer + sb->gap + gap_len, pos - sb->gap);
+	}
+
+	sb->gap = pos;
+}
+
+/* Keeps at least one byte spare for the terminator */
+static void sg_string_buffer_reserve(SgStringBuffer *sb, size_t length)
+{
+	if(length < sb->capacity)
+	{
+		return;
+	}
+
+	size_t capacity = sb->capacity ? 2 * sb->capacity : 64;
+	if(capacity <= length)
+	{
+		capacity = length + 1;
+	}
+
+	size_t tail = sb->length - sb->gap;
+	sb->buffer = sg_realloc(sb->buffer, capacity);
+	memmove(sb->buffer + capacity - tail, sb->buffer + sb->capacity - tail, tail);
+	sb->capacity = capacity;
+}
+
+/* Returns how many bytes were inserted, which is less than
+	new_count when a fixed buffer is full */
+static size_t sg_string_buffer_replace(SgStringBuffer *sb,
+	size_t index, size_t count, const void *elems, size_t new_count)
+{
+	++sb->version;
+	if(sb->owned)
+	{
+		sg_string_buffer_move_gap(sb, index);
+		sb->length -= count;
+		sg_string_buffer_reserve(sb, sb->length + new_count);
+		if(new_count)
+		{
+			memcpy(sb->buffer + sb->gap, elems, new_count);
+		}
+
+		sb->gap += new_count;
+		sb->length += new_count;
+		return new_count;
+	}
+
+	/* One byte stays free for the terminator, and text that does not
+		fit is cut at a code point boundary */
+	size_t limit = sb->capacity ? sb->capacity - 1 : 0;
+	size_t rest = sb->length - count;
+	size_t space = (limit > rest) ? limit - rest : 0;
+	if(new_count > space)
+	{
+		new_count = space;
+		while(new_count && (((const uint8_t *)elems)[new_count] & 0xC0) == 0x80)
+		{
+			--new_count;
+		}
+	}
+
+	memmove(sb->buffer + index + new_count,
+		sb->buffer + index + count,
+		sb->length - index - count);
+
+	if(new_count)
+	{
+		memcpy(sb->buffer + index, elems, new_count);
+	}
+
+	sb->length = sb->length - count + new_count;
+	return new_count;
+}
+
+void sg_string_buffer_init(SgStringBuffer *sb, const char *text)
+{
+	memset(sb, 0, sizeof(*sb));
+	sb->owned = true;
+	sg_string_buffer_set(sb, text);
+}
+
+void sg_string_buffer_set(SgStringBuffer *sb, const char *text)
+{
+	size_t len = text ? strlen(text) : 0;
+	sb->gap = 0;
+	sb->length = 0;
+	sg_string_buffer_replace(sb, 0, 0, text, len);
+}
+
+/* Closes the gap and terminates the text */
+const char *sg_string_buffer_cstr(SgStringBuffer *sb)
+{
+	if(sb->owned)
+	{
+		sg_string_buffer_move_gap(sb, sb->length);
+	}
+
+	if(sb->length < sb->capacity)
+	{
+		sb->buffer[sb->length] = '\0';
+	}
+
+	return sb->buffer;
+}
+
+/* Marks text written into buffer directly as changed */
+void sg_string_buffer_touch(SgStringBuffer *sb)
+{
+	++sb->version;
+}
+
+void sg_string_buffer_free(SgStringBuffer *sb)
+{
+	if(sb->owned)
+	{
+		sg_free(sb->buffer);
+	}
+
+	memset(sb, 0, sizeof(*sb));
+}
+
+/* ========================================================================== */
+/* text editing */
+
+/* The editing keys work on any text storage, so the textbox and
+	the multi line editor share them */
+typedef struct
+{
+	void *Data;
+	size_t (*Length)(void *data);
+	char (*At)(void *data, size_t index);
+	size_t (*Replace)(void *data, size_t index, size_t count,
+		const void *elems, size_t new_count);
+	size_t *Position;
+	size_t *Selection;
+	bool Multiline;
+	int PageLines;
+
+	/* Optional, moves pos by lines instead of sg_text_vertical */
+	size_t (*Vertical)(void *data, size_t pos, int lines);
+} SgTextEdit;
+
+bool sg_shift_down(void)
+{
+	return sg_is_key_down(SDL_SCANCODE_LSHIFT) ||
+		sg_is_key_down(SDL_SCANCODE_RSHIFT);
+}
+
+bool sg_char_stop(int c)
+{
+	return c == ' ' || c == '\n' || (ispunct(c) && c != '_');
+}
+
+static size_t sg_text_length(SgTextEdit *te)
+{
+	return te->Length(te->Data);
+}
+
+static char sg_text_at(SgTextEdit *te, size_t index)
+{
+	return te->At(te->Data, index);
+}
+
+/* Start of the character before pos */
+static size_t sg_text_prev(SgTextEdit *te, size_t pos)
+{
+	return pos ? sg_text_char_start(te->At, te->Data, sg_text_length(te), pos - 1) : 0;
+}
+
+/* Start of the character after pos */
+static size_t sg_text_next(SgTextEdit *te, size_t pos)
+{
+	size_t len = sg_text_length(te);
+	if(pos >= len)
+	{
+		return len;
+	}
+
+	size_t next;
+	sg_text_decode(te->At, te->Data, len, pos, &next);
+	return next;
+}
+
+static void sg_text_selection_replace(SgTextEdit *te,
+	const char *str, size_t len)
+{
+	size_t sel_start = sg_min_size(*te->Selection, *te->Position);
+	size_t sel_len = sg_max_size(*te->Selection, *te->Position) - sel_start;
+
+	len = te->Replace(te->Data, sel_start, sel_len, str, len);
+	*te->Position = sel_start + len;
+	*te->Selection = *te->Position;
+}
+
+static void sg_text_backspace(SgTextEdit *te)
+{
+	if(*te->Selection != *te->Position)
+	{
+		sg_text_selection_replace(te, NULL, 0);
+	}
+	else if(*te->Position > 0)
+	{
+		size_t prev = sg_text_prev(te, *te->Position);
+		te->Replace(te->Data, prev, *te->Position - prev, NULL, 0);
+		*te->Position = prev;
+		*te->Selection = prev;
+	}
+}
+
+static void sg_text_delete(SgTextEdit *te)
+{
+	if(*te->Selection != *te->Position)
+	{
+		sg_text_selection_replace(te, NULL, 0);
+	}
+	else if(*te->Position < sg_text_length(te))
+	{
+		te->Replace(te->Data, *te->Position,
+			sg_text_next(te, *te->Position) - *te->Position, NULL, 0);
+	}
+}
+
+/* With a glyph cache the text is UTF-8, otherwise chr is one byte */
+static void sg_text_char(SgTextEdit *te, uint32_t chr)
+{
+	char ins[5] = { chr, 0 };
+	if(chr >= 0x80 && _sg_fontatlas->Font)
+	{
+		sg_utf8_encode(chr, ins);
+	}
+
+	sg_text_selection_replace(te, ins, strlen(ins));
+}
+
+static void sg_text_selection_save(SgTextEdit *te)
+{
+	size_t sel_start = sg_min_size(*te->Selection, *te->Position);
+	size_t sel_len = sg_max_size(*te->Selection, *te->Position) - sel_start;
+	char *p = sg_malloc(sel_len + 1);
+	for(size_t i = 0; i < sel_len; ++i)
+	{
+		p[i] = sg_text_at(te, sel_start + i);
+	}
+
+	p[sel_len] = '\0';
+	SDL_SetClipboardText(p);
+	sg_free(p);
+}
+
+static void sg_text_copy(SgTextEdit *te)
+{
+	sg_text_selection_save(te);
+}
+
+static void sg_text_cut(SgTextEdit *te)
+{
+	sg_text_selection_save(te);
+	sg_text_selection_replace(te, NULL, 0);
+}
+
+static void sg_text_paste(SgTextEdit *te)
+{
+	char *p = SDL_GetClipboardText();
+	sg_text_selection_replace(te, p, strlen(p));
+	free(p);
+}
+
+static size_t sg_text_line_start(SgTextEdit *te, size_t pos)
+{
+	while(pos > 0 && sg_text_at(te, pos - 1) != '\n')
+	{
+		--pos;
+	}
+
+	return pos;
+}
+
+static size_t sg_text_line_end(SgTextEdit *te, size_t pos)
+{
+	size_t len = sg_text_length(te);
+	while(pos < len && sg_text_at(te, pos) != '\n')
+	{
+		++pos;
+	}
+
+	return pos;
+}
+
+/* Position lines below (or above, if negative) the caret,
+	keeping the column where possible */
+static size_t sg_text_vertical(SgTextEdit *te, int lines)
+{
+	if(te->Vertical)
+	{
+		return te->Vertical(te->Data, *te->Position, lines);
+	}
+
+	size_t pos = *te->Position;
+	size_t start = sg_text_line_start(te, pos);
+	size_t column = pos - start;
+	for(; lines < 0 && start > 0; ++lines)
+	{
+		start = sg_text_line_start(te, start - 1);
+	}
+
+	for(; lines > 0; --lines)
+	{
+		size_t end = sg_text_line_end(te, start);
+		if(end == sg_text_length(te))
+		{
+			break;
+		}
+
+		start = end + 1;
+	}
+
+	return sg_text_char_start(te->At, te->Data, sg_text_length(te),
+		sg_min_size(start + column, sg_text_line_end(te, start)));
+}
+
+static void sg_text_move(SgTextEdit *te, size_t pos, bool select)
+{
+	*te->Position = pos;
+	if(!select)
+	{
+		*te->Selection = pos;
+	}
+}
+
+static void sg_text_left(SgTextEdit *te)
+{
+	if(*te->Selection != *te->Position)
+	{
+		sg_text_move(te, sg_min_size(*te->Position, *te->Selection), false);
+	}
+	else if(*te->Position > 0)
+	{
+		sg_text_move(te, sg_text_prev(te, *te->Position), false);
+	}
+}
+
+static void sg_text_right(SgTextEdit *te)
+{
+	if(*te->Selection != *te->Position)
+	{
+		sg_text_move(te, sg_max_size(*te->Position, *te->Selection), false);
+	}
+	else if(*te->Position < sg_text_length(te))
+	{
+		sg_text_move(te, sg_text_next(te, *te->Position), false);
+	}
+}
+
+static void sg_text_select_all(SgTextEdit *te)
+{
+	*te->Selection = 0;
+	*te->Position = sg_text_length(te);
+}
+
+/* Selects the word around the caret */
+static void sg_text_select_word(SgTextEdit *te)
+{
+	size_t len = sg_text_length(te);
+	size_t pos = *te->Position;
+	for(; pos < len && !sg_char_stop(sg_text_at(te, pos)); ++pos)
+	{
+	}
+
+	size_t sel = pos;
+	for(; sel > 0 && !sg_char_stop(sg_text_at(te, sel - 1)); --sel)
+	{
+	}
+
+	*te->Position = pos;
+	*te->Selection = sel;
+}
+
+static int sg_text_event_key(SgTextEdit *te, uint32_t key, uint32_t chr)
+{
+	uint32_t nomods = key & 0xFF;
+	bool shift = key & MOD_SHIFT;
+	uint32_t plain = key & ~MOD_SHIFT;
+	if(plain == SDL_SCANCODE_HOME)
+	{
+		sg_text_move(te, te->Multiline ?
+			sg_text_line_start(te, *te->Position) : 0, shift);
+	}
+	else if(plain == SDL_SCANCODE_END)
+	{
+		sg_text_move(te, te->Multiline ?
+			sg_text_line_end(te, *te->Position) : sg_text_length(te), shift);
+	}
+	else if(key == SDL_SCANCODE_LEFT)
+	{
+		sg_text_left(te);
+	}
+	else if(key == (SDL_SCANCODE_LEFT | MOD_SHIFT))
+	{
+		sg_text_move(te, sg_text_prev(te, *te->Position), true);
+	}
+	else if(key == SDL_SCANCODE_RIGHT)
+	{
+		sg_text_right(te);
+	}
+	else if(key == (SDL_SCANCODE_RIGHT | MOD_SHIFT))
+	{
+		sg_text_move(te, sg_text_next(te, *te->Position), true);
+	}
+	else if(te->Multiline && plain == SDL_SCANCODE_UP)
+	{
+		sg_text_move(te, sg_text_vertical(te, -1), shift);
+	}
+	else if(te->Multiline && plain == SDL_SCANCODE_DOWN)
+	{
+		sg_text_move(te, sg_text_vertical(te, 1), shift);
+	}
+	else if(te->Multiline && plain == SDL_SCANCODE_PAGEUP)
+	{
+		sg_text_move(te, sg_text_vertical(te, -te->PageLines), shift);
+	}
+	else if(te->Multiline && plain == SDL_SCANCODE_PAGEDOWN)
+	{
+		sg_text_move(te, sg_text_vertical(te, te->PageLines), shift);
+	}
+	else if(nomods == SDL_SCANCODE_BACKSPACE)
+	{
+		sg_text_backspace(te);
+	}
+	else if(nomods == SDL_SCANCODE_DELETE)
+	{
+		sg_text_delete(te);
+	}
+	else if(key == (SDL_SCANCODE_A | MOD_CTRL))
+	{
+		sg_text_select_all(te);
+	}
+	else if(key == (SDL_SCANCODE_C | MOD_CTRL))
+	{
+		sg_text_copy(te);
+	}
+	else if(key == (SDL_SCANCODE_X | MOD_CTRL))
+	{
+		sg_text_cut(te);
+	}
+	else if(key == (SDL_SCANCODE_V | MOD_CTRL))
+	{
+		sg_text_paste(te);
+	}
+	else if(nomods == SDL_SCANCODE_RETURN)
+	{
+		if(!te->Multiline)
+		{
+			return '\n';
+		}
+
+		sg_text_char(te, '\n');
+	}
+	else if(isprint(chr) || (chr >= 0xA0 && _sg_fontatlas->Font))
+	{
+		sg_text_char(te, chr);
+	}
+
+	return 0;
+}
+
+static int sg_text_key_events(SgTextEdit *te)
+{
+	int result = 0;
+	for(int i = 0; i < _sg_keys_top; ++i)
+	{
+		int key = _sg_keys[i];
+		int chr = sg_key_to_codepoint(key);
+		int ret = sg_text_event_key(te, key, chr);
+		if(result != '\n')
+		{
+			result = ret;
+		}
+	}
+
+	return result;
+}
+
+/* ========================================================================== */
+/* sg_textbox */
+static size_t _sg_tb_selection;
+static size_t _sg_tb_position;
+static uint32_t _sg_tb_blink_start;
+static int _sg_tb_scroll;
+static SgStringBuffer *_sg_tb_focus;
+
+static size_t sg_textbox_length(void *data)
+{
+	return ((SgStringBuffer *)data)->length;
+}
+
+static char sg_textbox_at(void *data, size_t index)
+{
+	return sg_string_buffer_at(data, index);
+}
+
+static size_t sg_textbox_replace(void *data, size_t index, size_t count,
+	const void *elems, size_t new_count)
+{
+	return sg_string_buffer_replace(data, index, count, elems, new_count);
+}
+
+static SgTextEdit sg_textbox_edit(SgStringBuffer *sb)
+{
+	SgTextEdit te =
+	{
+		.Data = sb,
+		.Length = sg_textbox_length,
+		.At = sg_textbox_at,
+		.Replace = sg_textbox_replace,
+		.Position = &_sg_tb_position,
+		.Selection = &_sg_tb_selection,
+		.Multiline = false,
+		.PageLines = 0
+	};
+
+	return te;
+}
+
+int sg_textbox_event_key(SgStringBuffer *sb, uint32_t key, uint32_t chr)
+{
+	SgTextEdit te = sg_textbox_edit(sb);
+	return sg_text_event_key(&te, key, chr);
+}
+
+int sg_textbox_key_events(SgStringBuffer *sb)
+{
+	SgTextEdit te = sg_textbox_edit(sb);
+	return sg_text_key_events(&te);
+}
+
+/* Computes the x offset of every character of the focused textbox
+	and the total width, so that positions are lookups. The table is
+	only rebuilt when the text or the font atlas changed. */
+static void sg_textbox_measure(SgStringBuffer *sb)
+{
+	if(_sg_tb_measured == sb && _sg_tb_measured_length == sb->length &&
+		_sg_tb_measured_version == sb->version &&
+		_sg_tb_measured_atlas == _sg_fontatlas)
+	{
+		return;
+	}
+
+	_sg_tb_measured = sb;
+	_sg_tb_measured_length = sb->length;
+	_sg_tb_measured_version = sb->version;
+	_sg_tb_measured_atlas = _sg_fontatlas;
+
+	int n = 0;
+	while(n < (int)sb->length && sg_string_buffer_at(sb, n))
+	{
+		++n;
+	}
+
+	if(n + 1 > _sg_tb_offset_capacity)
+	{
+		_sg_tb_offset_capacity = sg_max(sg_max(64, 2 * _sg_tb_offset_capacity), n + 1);
+		_sg_tb_offsets = sg_realloc(_sg_tb_offsets,
+			_sg_tb_offset_capacity * sizeof(*_sg_tb_offsets));
+	}
+
+	/* The bytes of a multi byte character share its offset */
+	int x = 0;
+	for(size_t i = 0; i < (size_t)n;)
+	{
+		size_t next;
+		int w = sg_text_glyph(sg_textbox_at, sb, n, i, &next).w;
+		for(; i < next; ++i)
+		{
+			_sg_tb_offsets[i] = x;
+		}
+
+		x += w;
+	}
+
+	_sg_tb_offsets[n] = x;
+	_sg_tb_offset_count = n;
+}
+
+static int sg_textbox_offset(size_t index)
+{
+	return _sg_tb_offsets[sg_min_size(index, _sg_tb_offset_count)];
+}
+
+/* x is relative to the start of the text */
+static int sg_textbox_click(SgStringBuffer *sb, int x)
+{
+	/* First character whose center is right of x */
+	int lo = 0, hi = _sg_tb_offset_count;
+	while(lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		int left = _sg_tb_offsets[mid];
+		int center = left + (_sg_tb_offsets[mid + 1] - left) / 2;
+		if(x < center)
+		{
+			hi = mid;
+		}
+		else
+		{
+			lo = mid + 1;
+		}
+	}
+
+	return sg_text_char_start(sg_textbox_at, sb, _sg_tb_offset_count, lo);
+}
+
+static bool sg_textbox_cursor_visible(void)
+{
+	int blink = sg_theme->CursorBlinkMs;
+	if(blink <= 0)
+	{
+		return true;
+	}
+
+	/* Ask for a frame when the cursor toggles next */
+	uint32_t elapsed = SDL_GetTicks() - _sg_tb_blink_start;
+	sg_request_frame(blink - elapsed % blink);
+	return (elapsed / blink) % 2 == 0;
+}
+
+/* First character of the range that reaches into the visible area */
+static int sg_textbox_first_visible(int from, int to, int left)
+{
+	while(from < to)
+	{
+		int mid = from + (to - from) / 2;
+		if(_sg_tb_offsets[mid + 1] <= left)
+		{
+			from = mid + 1;
+		}
+		else
+		{
+			to = mid;
+		}
+	}
+
+	return from;
+}
+
+/* Only emits the characters that are within the clip rectangle r */
+static void sg_textbox_render_range(SgStringBuffer *sb, int from, int to,
+	SgPoint origin, SgRect r, SgColor color)
+{
+	to = sg_min(to, _sg_tb_offset_count);
+	int right = r.x + r.w - origin.x;
+	size_t i = sg_text_char_start(sg_textbox_at, sb, _sg_tb_offset_count,
+		sg_textbox_first_visible(from, to, r.x - origin.x));
+	while(i < (size_t)to && _sg_tb_offsets[i] < right)
+	{
+		SgPoint p = sg_point(origin.x + _sg_tb_offsets[i], origin.y);
+		sg_render_glyph(p, sg_text_glyph(sg_textbox_at, sb, to, i, &i), color);
+	}
+}
+
+/* Without focus there is no offset table and no scrolling,
+	so the text is drawn from the start until the right edge */
+static void sg_textbox_render_unfocused(SgStringBuffer *sb,
+	SgPoint p, SgRect r, SgColor color)
+{
+	int right = r.x + r.w;
+	size_t i = 0;
+	while(i < sb->length && p.x < right && sg_string_buffer_at(sb, i))
+	{
+		p.x += sg_render_glyph(p, sg_text_glyph(sg_textbox_at, sb, sb->length, i, &i), color);
+	}
+}
+
+/* Keeps the caret within the visible width w */
+static void sg_textbox_follow_caret(int w)
+{
+	int caret = sg_textbox_offset(_sg_tb_position);
+	int total = _sg_tb_offsets[_sg_tb_offset_count] + sg_theme->Cursor.w;
+	if(caret < _sg_tb_scroll)
+	{
+		_sg_tb_scroll = caret;
+	}
+	else if(caret + sg_theme->Cursor.w > _sg_tb_scroll + w)
+	{
+		_sg_tb_scroll = caret + sg_theme->Cursor.w - w;
+	}
+
+	_sg_tb_scroll = sg_max(0, sg_min(_sg_tb_scroll, total - w));
+}
+
+int sg_textbox(SgRect d, SgStringBuffer *sb)
+{
+	sg_zone_begin("sg_textbox");
+	sg_widget_begin();
+	int result = 0;
+	int index;
+	bool selected = sg_selected(d, &index, &_sg_selected);
+	SgColor text_color = sg_theme->TextboxTextColor[index];
+	int border = sg_theme->TextboxBorderThickness[index];
+	int text_x = d.x + sg_theme->TextboxPaddingX;
+	int text_w = d.w - 2 * sg_theme->TextboxPaddingX;
+
+	if(selected)
+	{
+		if(sb != _sg_tb_focus)
+		{
+			_sg_tb_focus = sb;
+			_sg_tb_measured = NULL;
+			_sg_tb_scroll = 0;
+		}
+
+		sg_textbox_measure(sb);
+		int mouse_x = sg_mouse_position().x - (text_x - _sg_tb_scroll);
+		if(sg_rect_contains_mouse(d))
+		{
+			if(sg_triple_click)
+			{
+				_sg_tb_position = sb->length;
+				_sg_tb_selection = 0;
+				_sg_tb_multi_clicked = true;
+			}
+			else if(sg_double_click)
+			{
+				SgTextEdit te = sg_textbox_edit(sb);
+				_sg_tb_position = sg_textbox_click(sb, mouse_x);
+				sg_text_select_word(&te);
+				_sg_tb_multi_clicked = true;
+			}
+			else
+			{
+				if(sg_is_mouse_button_pressed(SG_BUTTON_LEFT) && !sg_shift_down())
+				{
+					_sg_tb_position = sg_textbox_click(sb, mouse_x);
+					_sg_tb_selection = _sg_tb_position;
+				}
+				else if(sg_is_mouse_button_down(SG_BUTTON_LEFT) && !_sg_tb_multi_clicked)
+				{
+					_sg_tb_position = sg_textbox_click(sb, mouse_x);
+				}
+			}
+		}
+		else if(sg_is_mouse_button_down(SG_BUTTON_LEFT) && !_sg_tb_multi_clicked)
+		{
+			/* Dragging past the edge scrolls */
+			_sg_tb_position = sg_textbox_click(sb, mouse_x);
+		}
+
+		if(_sg_keys_top > 0 || sg_is_mouse_button_pressed(SG_BUTTON_LEFT))
+		{
+			_sg_tb_blink_start = SDL_GetTicks();
+		}
+
+		if(_sg_keys_top > 0)
+		{
+			result = sg_textbox_key_events(sb);
+			sg_textbox_measure(sb);
+		}
+
+		sg_textbox_follow_caret(text_w);
+	}
+
+	sg_box(d, index, sg_theme->TextboxInnerColor,
+		sg_theme->TextboxBorderColor, sg_theme->TextboxBorderThickness);
+
+	SgRect clip = sg_rect(d.x + border, d.y + border,
+		d.w - 2 * border, d.h - 2 * border);
+	sg_push_clip(clip);
+
+	int text_y = d.y + d.h / 2 - _sg_fontatlas->FontHeight / 2;
+	SgPoint origin = sg_point(text_x - (selected ? _sg_tb_scroll : 0), text_y);
+
+	if(!selected)
+	{
+		sg_textbox_render_unfocused(sb, origin, clip, text_color);
+	}
+	else if(_sg_tb_selection == _sg_tb_position)
+	{
+		sg_textbox_render_range(sb, 0, _sg_tb_offset_count,
+			origin, clip, text_color);
+	}
+	else
+	{
+		int sel_start = sg_min_size(sg_min_size(_sg_tb_selection, _sg_tb_position),
+			_sg_tb_offset_count);
+		int sel_end = sg_min_size(sg_max_size(_sg_tb_selection, _sg_tb_position),
+			_sg_tb_offset_count);
+		int sel_x = sg_textbox_offset(sel_start);
+
+		sg_textbox_render_range(sb, 0, sel_start,
+			origin, clip, text_color);
+
+		sg_fill_rect(sg_rect(
+			origin.x + sel_x,
+			text_y + sg_theme->Cursor.y,
+			sg_textbox_offset(sel_end) - sel_x,
+			_sg_fontatlas->FontHeight + sg_theme->Cursor.h),
+			sg_theme->SelectionColor);
 
-	/* Slider */
-	.SliderThumbColor = { 0x7b0000, 0xff8200, 0xffb200 },
-	.SliderRailColor = { 0x510000, 0x7b0000, 0x9b0000 },
-	.SliderThumbWidth = 6,
-	.SliderRailHeight = 6,
+		sg_textbox_render_range(sb, sel_start, sel_end,
+			origin, clip, sg_theme->SelectionTextColor);
 
-	/* Select */
-	.SelectTextColor = { 0xff8200, 0xff8200, 0xff8200 },
-	.SelectInnerColor = { 0x310000, 0x7b0000, 0x510000 },
-	.SelectBorderColor = { 0x7b0000, 0xff8200, 0xff8200 },
-	.SelectBorderThickness = { 2, 2, 1 },
-	.SelectPageBorderColor = 0x333333,
-	.SelectPageBorderThickness = 1,
-	.SelectItemInnerColor = { 0xFFFFFF, 0x3399ff },
-	.SelectItemTextColor = { 0x000000, 0xFFFFFF },
-	.SelectItemPadding = 3,
-	.SelectPageItems = 5,
-	.SelectPaddingX = 10,
-};
+		sg_textbox_render_range(sb, sel_end, _sg_tb_offset_count,
+			origin, clip, text_color);
+	}
 
-SgTheme *sg_theme = &sg_default_theme;
+	if(selected && sg_textbox_cursor_visible())
+	{
+		sg_fill_rect(sg_rect(origin.x +
+			sg_textbox_offset(_sg_tb_position) + sg_theme->Cursor.x,
+			text_y + sg_theme->Cursor.y,
+			sg_theme->Cursor.w,
+			_sg_fontatlas->FontHeight + sg_theme->Cursor.h),
+			sg_theme->CursorColor);
+	}
 
-/* ========================================================================== */
-/* sg_color */
-SgColor sg_color(int r, int g, int b)
-{
-	return (r << 16) | (g << 8) | b;
+	sg_pop_clip();
+	sg_widget_end();
+	sg_zone_end();
+	return result;
 }
 
 /* ========================================================================== */
-/* sg_rect */
-bool sg_rect_contains_point(SgRect rect, SgPoint p)
-{
-	return p.x >= rect.x && p.y >= rect.y &&
-		p.x < rect.x + rect.w && p.y < rect.y + rect.h;
-}
+/* sg_select_filter */
+static size_t _sg_filter_highlight;
+static bool _sg_filter_changed;
 
-bool sg_rect_contains_mouse(SgRect rect)
+static int sg_fold(char c)
 {
-	return sg_rect_contains_point(rect, sg_mouse_position());
+	return tolower((uint8_t)c);
 }
 
-/* ========================================================================== */
-/* common functions for controls */
-void sg_border_rect(SgRect d, SgColor inner, SgColor border, int thickness)
+/* Compares at most n characters ignoring case */
+static int sg_strncmp_fold(const char *a, const char *b, size_t n)
 {
-	SgRect inner_rect =
+	for(; n > 0; --n, ++a, ++b)
 	{
-		d.x + thickness,
-		d.y + thickness,
-		d.w - 2 * thickness,
-		d.h - 2 * thickness
-	};
+		int d = sg_fold(*a) - sg_fold(*b);
+		if(d || !*a)
+		{
+			return d;
+		}
+	}
 
-	sg_fill_rect(inner_rect, inner);
-	sg_draw_rect(d, thickness, border);
+	return 0;
 }
 
-void sg_box(SgRect d, int index, SgColor *inner_color,
-	SgColor *border_color, int *border_thickness)
+static bool sg_contains_fold(const char *s, const char *q, size_t len)
 {
-	sg_border_rect(d, inner_color[index],
-		border_color[index], border_thickness[index]);
+	for(; *s; ++s)
+	{
+		if(!sg_strncmp_fold(s, q, len))
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
-bool sg_clicked(SgRect d, int *index)
+/* Sort entry, the first eight folded characters are compared as one
+	number so that most comparisons do not touch the strings */
+typedef struct
 {
-	bool hover = sg_rect_contains_mouse(d);
-	bool active = sg_is_mouse_button_down(SG_BUTTON_LEFT);
-	*index = (hover ? (active ? SG_INDEX_ACTIVE : SG_INDEX_HOVER) : SG_INDEX_DEFAULT);
-	return hover && sg_is_mouse_button_pressed(SG_BUTTON_LEFT);
-}
+	uint64_t Key;
+	size_t Index;
+} SgFilterEntry;
 
-bool sg_selected(SgRect d, int *index, bool *state)
+static int sg_filter_compare(const void *a, const void *b)
 {
-	bool hover = sg_rect_contains_mouse(d);
-	if(hover && sg_is_mouse_button_down(SG_BUTTON_LEFT))
+	const SgFilterEntry *x = a;
+	const SgFilterEntry *y = b;
+	if(x->Key != y->Key)
 	{
-		*state = true;
-		_sg_selected_point = sg_mouse_position();
+		return x->Key < y->Key ? -1 : 1;
 	}
 
-	bool sel = *state && sg_rect_contains_point(d, _sg_selected_point);
-	*index = sel ? SG_INDEX_ACTIVE : (hover ? SG_INDEX_HOVER : SG_INDEX_DEFAULT);
-	return sel;
-}
+	/* Equal keys without a zero byte continue after it */
+	int d = 0;
+	if(x->Key & 0xFF)
+	{
+		d = sg_strncmp_fold(_sg_filter_items[x->Index] + 8,
+			_sg_filter_items[y->Index] + 8, SIZE_MAX);
+	}
 
-/* ========================================================================== */
-/* sg_label */
-void sg_label(SgRect d, const char *text, int flags)
-{
-	sg_render_string_in_rect(d, text, flags, sg_theme->LabelTextColor);
+	return d ? d : (x->Index > y->Index) - (x->Index < y->Index);
 }
 
-/* ========================================================================== */
-/* sg_button */
-bool sg_button(SgRect d, const char *text)
+/* Sorts the items once, the index is reused while
+	the same array is passed in */
+static void sg_filter_build(const char **items, size_t count)
 {
-	int index;
-	bool clicked = sg_clicked(d, &index);
+	if(items == _sg_filter_items && count == _sg_filter_count)
+	{
+		return;
+	}
 
-	sg_box(d, index, sg_theme->ButtonInnerColor,
-		sg_theme->ButtonBorderColor, sg_theme->ButtonBorderThickness);
-	sg_render_string_in_rect(d, text, SG_CENTER, sg_theme->ButtonTextColor[index]);
+	SgFilterEntry *entries = sg_malloc(count * sizeof(*entries));
+	for(size_t i = 0; i < count; ++i)
+	{
+		const char *s = items[i];
+		uint64_t key = 0;
+		int n = 0;
+		for(; n < 8 && s[n]; ++n)
+		{
+			key = (key << 8) | (uint64_t)sg_fold(s[n]);
+		}
 
-	return clicked;
+		entries[i].Key = key << (8 * (8 - n));
+		entries[i].Index = i;
+	}
+
+	_sg_filter_items = items;
+	_sg_filter_count = count;
+	qsort(entries, count, sizeof(*entries), sg_filter_compare);
+
+	_sg_filter_index = sg_realloc(_sg_filter_index, count * sizeof(*_sg_filter_index));
+	for(size_t i = 0; i < count; ++i)
+	{
+		_sg_filter_index[i] = entries[i].Index;
+	}
+
+	sg_free(entries);
+	_sg_filter_changed = true;
 }
 
-/* ========================================================================== */
-/* sg_checkbox */
-void sg_set_checkmark_char(uint8_t index)
+/* First index position whose prefix is not less than q,
+	or with upper, greater than q */
+static size_t sg_filter_bound(const char *q, size_t len, bool upper)
 {
-	_sg_char_checkmark = index;
+	size_t lo = 0;
+	size_t hi = _sg_filter_count;
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		int d = sg_strncmp_fold(_sg_filter_items[_sg_filter_index[mid]], q, len);
+		if(d < 0 || (upper && d == 0))
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	return lo;
 }
 
-uint8_t sg_get_checkmark_char(void)
+static void sg_filter_query(void)
 {
-	return sg_char_width(_sg_char_checkmark) > 0 ? _sg_char_checkmark : 'X';
+	const char *q = sg_string_buffer_cstr(&_sg_filter_query);
+	size_t len = _sg_filter_query.length;
+	_sg_filter_match_count = 0;
+	_sg_filter_scan = len ? 0 : _sg_filter_count;
+	_sg_filter_lo = len ? sg_filter_bound(q, len, false) : 0;
+	_sg_filter_hi = len ? sg_filter_bound(q, len, true) : 0;
 }
 
-bool sg_checkbox(SgRect d, bool *checked)
+/* Continues the substring search where the last frame stopped */
+static void sg_filter_scan(void)
 {
-	int index;
-	bool clicked = sg_clicked(d, &index);
-
-	sg_box(d, index, sg_theme->CheckboxInnerColor,
-		sg_theme->CheckboxBorderColor, sg_theme->CheckboxBorderThickness);
-	if(*checked)
+	const char *q = sg_string_buffer_cstr(&_sg_filter_query);
+	size_t len = _sg_filter_query.length;
+	size_t end = _sg_filter_scan + SG_FILTER_SCAN_STEP;
+	if(end > _sg_filter_count)
 	{
-		sg_render_char_in_rect(d, sg_get_checkmark_char(),
-			SG_CENTER, sg_theme->CheckboxIconColor[index]);
+		end = _sg_filter_count;
 	}
 
-	if(clicked)
+	for(; _sg_filter_scan < end; ++_sg_filter_scan)
 	{
-		*checked = !*checked;
+		const char *s = _sg_filter_items[_sg_filter_scan];
+		if(!*s || !sg_strncmp_fold(s, q, len) || !sg_contains_fold(s + 1, q, len))
+		{
+			continue;
+		}
+
+		if(_sg_filter_match_count == _sg_filter_match_capacity)
+		{
+			_sg_filter_match_capacity = _sg_filter_match_capacity ?
+				2 * _sg_filter_match_capacity : 256;
+			_sg_filter_matches = sg_realloc(_sg_filter_matches,
+				_sg_filter_match_capacity * sizeof(*_sg_filter_matches));
+		}
+
+		_sg_filter_matches[_sg_filter_match_count++] = _sg_filter_scan;
 	}
 
-	return clicked;
+	if(_sg_filter_scan < _sg_filter_count)
+	{
+		sg_request_frame(0);
+	}
 }
 
-/* ========================================================================== */
-/* sg_slider */
-int sg_slider(SgRect d, double *value, double min, double max)
+/* Prefix matches in sorted order come first, then substring matches,
+	an empty query lists all items */
+static size_t sg_filter_rows(void)
 {
-	int index;
-	bool active = sg_selected(d, &index, &_sg_drag);
-
-	sg_fill_rect(sg_rect(d.x, d.y + d.h / 2 - sg_theme->SliderRailHeight / 2, d.w, sg_theme->SliderRailHeight),
-		sg_theme->SliderRailColor[index]);
+	if(!_sg_filter_query.length)
+	{
+		return _sg_filter_count;
+	}
 
-	int thumb_pos = d.x + (*value - min) / (max - min) * (d.w - sg_theme->SliderThumbWidth);
-	sg_fill_rect(sg_rect(thumb_pos, d.y, sg_theme->SliderThumbWidth, d.h),
-		sg_theme->SliderThumbColor[index]);
+	return _sg_filter_hi - _sg_filter_lo + _sg_filter_match_count;
+}
 
-	double prev_value = *value;
-	if(active)
+static size_t sg_filter_item(size_t row)
+{
+	size_t prefix = _sg_filter_hi - _sg_filter_lo;
+	if(!_sg_filter_query.length)
 	{
-		SgPoint mouse = sg_mouse_position();
-		double percent = (mouse.x - (d.x + sg_theme->SliderThumbWidth / 2)) /
-			(double)(d.w - sg_theme->SliderThumbWidth);
-		*value = min + sg_fclamp(percent, 0.0, 1.0) * (max - min);
+		return row;
 	}
 
-	return *value != prev_value;
+	return row < prefix ? _sg_filter_index[_sg_filter_lo + row] :
+		_sg_filter_matches[row - prefix];
 }
 
-/* ========================================================================== */
-/* sg_select */
-void sg_set_select_char(uint8_t index)
+static const char *sg_filter_text(size_t row)
 {
-	_sg_char_select = index;
+	return _sg_filter_items[sg_filter_item(row)];
 }
 
-uint8_t sg_get_select_char(void)
+static size_t sg_filter_replace(void *data, size_t index, size_t count,
+	const void *elems, size_t new_count)
 {
-	return sg_char_width(_sg_char_select) > 0 ? _sg_char_select : 'V';
+	_sg_filter_changed = true;
+	return sg_string_buffer_replace(data, index, count, elems, new_count);
 }
 
-bool sg_select_selected(SgRect d, int *index)
+static SgTextEdit sg_filter_edit(void)
 {
-	bool hover = sg_rect_contains_mouse(d);
-	bool click = hover && sg_is_mouse_button_pressed(SG_BUTTON_LEFT);
-
-	bool sel = _sg_select_selected && sg_rect_contains_point(d, _sg_selected_point);
-	if(sel && click)
-	{
-		_sg_select_selected = false;
-	}
-	else if(click)
+	SgTextEdit te =
 	{
-		_sg_select_selected = !_sg_select_selected;
-		_sg_selected_point = sg_mouse_position();
-		sel = _sg_select_selected;
-	}
+		.Data = &_sg_filter_query,
+		.Length = sg_textbox_length,
+		.At = sg_textbox_at,
+		.Replace = sg_filter_replace,
+		.Position = &_sg_filter_position,
+		.Selection = &_sg_filter_selection,
+		.Multiline = false,
+		.PageLines = 0
+	};
 
-	*index = sel ? SG_INDEX_ACTIVE : (hover ? SG_INDEX_HOVER : SG_INDEX_DEFAULT);
-	return sel;
+	return te;
 }
 
-void sg_select_render_dropdown(void)
+/* Edits the query, Up and Down move the highlighted row,
+	returns true when Enter was pressed */
+static bool sg_filter_key_events(void)
 {
-	if(!_sg_select_items)
-	{
-		return;
-	}
-
-	SgRect d = _sg_select_dim;
-	const char **items = _sg_select_items;
-	int count = _sg_select_item_count;
-	int cur = _sg_select_item_cur;
-	int start = _sg_select_item_start;
-
-	int num_elems = sg_min(sg_theme->SelectPageItems, count);
-	int elem_h = d.h - sg_theme->SelectItemPadding;
-	int total_h = num_elems * elem_h +
-		2 * sg_theme->SelectPageBorderThickness +
-		(num_elems + 1) * sg_theme->SelectItemPadding;
-
-	sg_border_rect(sg_rect(d.x, d.y + d.h, d.w, total_h),
-		sg_theme->SelectItemInnerColor[SG_INDEX_DEFAULT],
-		sg_theme->SelectPageBorderColor,
-		sg_theme->SelectPageBorderThickness);
-
-	SgRect b = sg_rect(
-		d.x + sg_theme->SelectItemPadding + sg_theme->SelectPageBorderThickness,
-		d.y + d.h + sg_theme->SelectPageBorderThickness + sg_theme->SelectItemPadding,
-		d.w - 2 * (sg_theme->SelectItemPadding + sg_theme->SelectPageBorderThickness),
-		d.h - sg_theme->SelectItemPadding);
-
-	for(int i = 0; i < num_elems; ++i, b.y += d.h)
+	SgTextEdit te = sg_filter_edit();
+	bool enter = false;
+	for(int i = 0; i < _sg_keys_top; ++i)
 	{
-		if(i == cur)
+		int key = _sg_keys[i];
+		size_t page = sg_max(sg_theme->SelectPageItems, 1);
+		if(key == SDL_SCANCODE_UP && _sg_filter_highlight > 0)
 		{
-			sg_fill_rect(b, sg_theme->SelectItemInnerColor[SG_INDEX_HOVER]);
+			--_sg_filter_highlight;
+		}
+		else if(key == SDL_SCANCODE_DOWN)
+		{
+			++_sg_filter_highlight;
+		}
+		else if(key == SDL_SCANCODE_ESCAPE)
+		{
+			_sg_select_selected = false;
+		}
+		else if(sg_text_event_key(&te, key, sg_key_to_codepoint(key)) == '\n')
+		{
+			enter = true;
 		}
 
-		sg_render_string_in_rect(
-			sg_rect(d.x + sg_theme->SelectPaddingX, b.y, b.w, b.h),
-			items[i], SG_CENTER_LEFT,
-			sg_theme->SelectTextColor[i == cur ? SG_INDEX_HOVER : SG_INDEX_DEFAULT]);
+		/* Keep the highlighted row in view */
+		if(_sg_filter_highlight < _sg_select_item_start)
+		{
+			_sg_select_item_start = _sg_filter_highlight;
+		}
+		else if(_sg_filter_highlight >= _sg_select_item_start + page)
+		{
+			_sg_select_item_start = _sg_filter_highlight - page + 1;
+		}
 	}
+
+	return enter;
 }
 
-int sg_select(SgRect d, const char *items[], size_t count, size_t *current)
+int sg_select_filter(SgRect d, const char *items[], size_t count, size_t *current)
 {
+	sg_zone_begin("sg_select_filter");
+	sg_widget_begin();
 	assert(count > 0);
 
+	bool opened = !_sg_select_selected;
 	int index;
 	bool selected = sg_select_selected(d, &index);
+	int changed = 0;
+	size_t rows = 0;
+	if(selected)
+	{
+		if(opened)
+		{
+			if(_sg_filter_query.owned)
+			{
+				sg_string_buffer_set(&_sg_filter_query, NULL);
+			}
+			else
+			{
+				sg_string_buffer_init(&_sg_filter_query, NULL);
+			}
 
-	sg_box(d, index, sg_theme->SelectInnerColor,
-		sg_theme->SelectBorderColor, sg_theme->SelectBorderThickness);
+			_sg_filter_position = 0;
+			_sg_filter_selection = 0;
+			_sg_filter_changed = true;
+			_sg_select_scrolling = false;
+		}
 
-	sg_render_string(
-		sg_point(d.x + sg_theme->SelectPaddingX, d.y + d.h / 2 - _sg_fontatlas->FontHeight / 2),
-		items[*current], sg_theme->SelectTextColor[index]);
+		sg_filter_build(items, count);
 
-	sg_render_char_align(
-		sg_point(d.x + d.w - sg_theme->SelectPaddingX, d.y + d.h / 2),
-		sg_get_select_char(), SG_CENTER_RIGHT, sg_theme->SelectTextColor[index]);
+		bool enter = false;
+		if(_sg_keys_top > 0)
+		{
+			_sg_tb_blink_start = SDL_GetTicks();
+			enter = sg_filter_key_events();
+		}
+
+		if(_sg_filter_changed)
+		{
+			_sg_filter_changed = false;
+			_sg_filter_highlight = 0;
+			_sg_select_item_start = 0;
+			sg_filter_query();
+		}
+
+		sg_filter_scan();
+		rows = sg_filter_rows();
+		if(_sg_filter_highlight >= rows)
+		{
+			_sg_filter_highlight = rows ? rows - 1 : 0;
+		}
+
+		size_t row;
+		if(sg_select_page_input(d, rows, &row))
+		{
+			*current = sg_filter_item(row);
+			changed = 1;
+		}
+		else if(enter && rows > 0)
+		{
+			*current = sg_filter_item(_sg_filter_highlight);
+			_sg_select_selected = false;
+			changed = 1;
+		}
+
+		selected = _sg_select_selected;
+		if(!selected)
+		{
+			index = sg_rect_contains_mouse(d) ? SG_INDEX_HOVER : SG_INDEX_DEFAULT;
+		}
+	}
+
+	if(selected)
+	{
+		const char *query = _sg_filter_query.length ?
+			sg_string_buffer_cstr(&_sg_filter_query) : "";
+		sg_select_box(d, index, query, _sg_filter_query.length,
+			sg_textbox_cursor_visible() ? (int)_sg_filter_position : -1);
+	}
+	else
+	{
+		sg_select_box(d, index, items[*current], strlen(items[*current]), -1);
+	}
+
+	sg_widget_end();
+	sg_zone_end();
 
 	if(selected)
 	{
-		_sg_select_items = items;
-		_sg_select_item_count = count;
-		_sg_select_item_cur = *current;
-		_sg_select_dim = d;
-		_sg_select_item_start = 0; // TODO
+		sg_select_open(d, sg_filter_text, rows, _sg_filter_highlight);
 	}
 
-	return 0;
+	return changed;
 }
 
 /* ========================================================================== */
-/* sg_textbox */
-static int _sg_tb_selection;
-static int _sg_tb_position;
-
-static void sg_textbox_replace(SgStringBuffer *sb,
-	uint32_t index, uint32_t count,
-	const void *elems, uint32_t new_count)
+/* sg_editor */
+enum
 {
-	uint32_t new_length = sb->length - count + new_count;
-	uint32_t last_bytes = (sb->length - index - count);
-	memmove(sb->buffer + index + new_count,
-		sb->buffer + index + count,
-		last_bytes);
-
-	memcpy(sb->buffer + index, elems, new_count);
-	sb->length = new_length;
-}
+	SG_PIECE_ORIGINAL,
+	SG_PIECE_ADDED
+};
 
-static void sg_textbox_remove(SgStringBuffer *sb, uint32_t index)
+static const char *sg_piece_text(const SgEditor *ed, const SgPiece *piece)
 {
-	sg_textbox_replace(sb, index, 1, NULL, 0);
+	return (piece->Source == SG_PIECE_ADDED ? ed->Added : ed->Original) + piece->Start;
 }
 
-static void sg_textbox_selection_replace(SgStringBuffer *sb,
-	const char *str, int len)
+/* Index of the piece that contains pos and the position it starts at.
+	Starts from the last lookup, so walking the text is O(1) per step */
+static size_t sg_editor_find(SgEditor *ed, size_t pos, size_t *start)
 {
-	int sel_start = sg_min(_sg_tb_selection, _sg_tb_position);
-	int sel_len = sg_max(_sg_tb_selection, _sg_tb_position) - sel_start;
+	size_t i = ed->CachePiece;
+	size_t s = ed->CacheStart;
+	if(i > ed->PieceCount)
+	{
+		i = 0;
+		s = 0;
+	}
 
-	sg_textbox_replace(sb, sel_start, sel_len, str, len);
-	_sg_tb_position = sel_start + len;
-	_sg_tb_selection = _sg_tb_position;
-}
+	while(i > 0 && pos < s)
+	{
+		--i;
+		s -= ed->Pieces[i].Length;
+	}
 
-static void sg_textbox_backspace(SgStringBuffer *sb)
-{
-	if(_sg_tb_selection != _sg_tb_position)
+	while(i < ed->PieceCount && pos >= s + ed->Pieces[i].Length)
 	{
-		sg_textbox_selection_replace(sb, NULL, 0);
+		s += ed->Pieces[i].Length;
+		++i;
 	}
-	else if(_sg_tb_position > 0)
+
+	ed->CachePiece = i;
+	ed->CacheStart = s;
+	*start = s;
+	return i;
+}
+
+static char sg_editor_char(SgEditor *ed, size_t pos)
+{
+	size_t start;
+	size_t i = sg_editor_find(ed, pos, &start);
+	if(i >= ed->PieceCount)
 	{
-		--_sg_tb_position;
-		_sg_tb_selection = _sg_tb_position;
-		sg_textbox_remove(sb, _sg_tb_position);
+		return '\0';
 	}
+
+	return sg_piece_text(ed, &ed->Pieces[i])[pos - start];
 }
 
-static void sg_textbox_delete(SgStringBuffer *sb)
+/* Opens count slots at index i */
+static void sg_editor_pieces_open(SgEditor *ed, size_t i, size_t count)
 {
-	if(_sg_tb_selection != _sg_tb_position)
+	if(ed->PieceCount + count > ed->PieceCapacity)
 	{
-		sg_textbox_selection_replace(sb, NULL, 0);
+		ed->PieceCapacity = sg_max_size(2 * ed->PieceCapacity, 16) + count;
+		ed->Pieces = sg_realloc(ed->Pieces, ed->PieceCapacity * sizeof(SgPiece));
 	}
-	else if(_sg_tb_position < (int)sb->length)
+
+	memmove(ed->Pieces + i + count, ed->Pieces + i,
+		(ed->PieceCount - i) * sizeof(SgPiece));
+	ed->PieceCount += count;
+}
+
+/* The line starts are a gap array like SgStringBuffer. Starts after the
+	gap are stored as distance from the end of the text, so an edit only
+	moves the gap to its line instead of shifting every following start. */
+static size_t sg_editor_line_start(const SgEditor *ed, size_t line)
+{
+	if(line < ed->LineGap)
 	{
-		sg_textbox_remove(sb, _sg_tb_position);
+		return ed->Lines[line];
 	}
+
+	return ed->Length - ed->Lines[line + ed->LineCapacity - ed->LineCount];
 }
 
-static void sg_textbox_char(SgStringBuffer *sb, uint32_t chr)
+/* Index of the first line that starts after pos */
+static size_t sg_editor_line_after(const SgEditor *ed, size_t pos)
 {
-	char ins = chr;
-	sg_textbox_selection_replace(sb, &ins, 1);
+	size_t lo = 0, hi = ed->LineCount;
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if(sg_editor_line_start(ed, mid) <= pos)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	return lo;
 }
 
-static void sg_tb_selection_save(SgStringBuffer *sb)
+static size_t sg_editor_line_of(const SgEditor *ed, size_t pos)
 {
-	int sel_start = sg_min(_sg_tb_selection, _sg_tb_position);
-	int sel_len = sg_max(_sg_tb_selection, _sg_tb_position) - sel_start;
-	char *p = sb->buffer + sel_start + sel_len;
-	int chr = *p;
-	*p = '\0';
-	SDL_SetClipboardText(sb->buffer + sel_start);
-	*p = chr;
+	return sg_editor_line_after(ed, pos) - 1;
 }
 
-static void sg_textbox_copy(SgStringBuffer *sb)
+static size_t sg_editor_line_end(const SgEditor *ed, size_t line)
 {
-	sg_tb_selection_save(sb);
+	return (line + 1 < ed->LineCount) ? sg_editor_line_start(ed, line + 1) - 1 : ed->Length;
 }
 
-static void sg_textbox_cut(SgStringBuffer *sb)
+/* Has to be called before ed->Length changes */
+static void sg_editor_lines_move_gap(SgEditor *ed, size_t line)
 {
-	sg_tb_selection_save(sb);
-	sg_textbox_selection_replace(sb, NULL, 0);
+	size_t gap_len = ed->LineCapacity - ed->LineCount;
+	while(ed->LineGap > line)
+	{
+		--ed->LineGap;
+		ed->Lines[ed->LineGap + gap_len] = ed->Length - ed->Lines[ed->LineGap];
+	}
+
+	while(ed->LineGap < line)
+	{
+		ed->Lines[ed->LineGap] = ed->Length - ed->Lines[ed->LineGap + gap_len];
+		++ed->LineGap;
+	}
 }
 
-static void sg_textbox_paste(SgStringBuffer *sb)
+static void sg_editor_lines_reserve(SgEditor *ed, size_t count)
 {
-	char *p = SDL_GetClipboardText();
-	sg_textbox_selection_replace(sb, p, strlen(p));
-	free(p);
+	if(ed->LineCount + count <= ed->LineCapacity)
+	{
+		return;
+	}
+
+	size_t capacity = sg_max_size(2 * ed->LineCapacity, 64) + count;
+	size_t tail = ed->LineCount - ed->LineGap;
+	ed->Lines = sg_realloc(ed->Lines, capacity * sizeof(size_t));
+	memmove(ed->Lines + capacity - tail, ed->Lines + ed->LineCapacity - tail,
+		tail * sizeof(size_t));
+	ed->LineCapacity = capacity;
 }
 
-static int sg_textbox_click(SgStringBuffer *sb, int x, int tb_x)
+/* The line index is updated from the edit alone, the text is never rescanned */
+static void sg_editor_lines_insert(SgEditor *ed, size_t pos, const char *text, size_t len)
 {
-	tb_x += sg_theme->TextboxPaddingX;
-	if(x < tb_x)
+	sg_editor_lines_move_gap(ed, sg_editor_line_after(ed, pos));
+
+	size_t count = 0;
+	for(size_t i = 0; i < len; ++i)
 	{
-		return 0;
+		count += (text[i] == '\n');
 	}
 
-	size_t i = 0;
-	for(uint8_t c; (c = sb->buffer[i]) && i < sb->length; ++i)
+	if(!count)
+	{
+		return;
+	}
+
+	sg_editor_lines_reserve(ed, count);
+	ed->LineCount += count;
+	for(size_t i = 0; i < len; ++i)
 	{
-		int w = sg_char_width(c);
-		if(x < tb_x + w / 2)
+		if(text[i] == '\n')
 		{
-			return i;
+			ed->Lines[ed->LineGap++] = pos + i + 1;
 		}
-
-		tb_x += w;
 	}
+}
 
-	return sb->length;
+/* Widening the gap drops the lines that started in the deleted text */
+static void sg_editor_lines_delete(SgEditor *ed, size_t pos, size_t count)
+{
+	size_t lo = sg_editor_line_after(ed, pos);
+	size_t hi = sg_editor_line_after(ed, pos + count);
+	sg_editor_lines_move_gap(ed, lo);
+	ed->LineCount -= hi - lo;
 }
 
-static void sg_textbox_left(void)
+static void sg_editor_insert(SgEditor *ed, size_t pos, const char *text, size_t len)
 {
-	if(_sg_tb_selection != _sg_tb_position)
+	if(ed->AddedLength + len > ed->AddedCapacity)
+	{
+		ed->AddedCapacity = sg_max_size(2 * ed->AddedCapacity, 4096) + len;
+		ed->Added = sg_realloc(ed->Added, ed->AddedCapacity);
+	}
+
+	size_t added = ed->AddedLength;
+	memcpy(ed->Added + added, text, len);
+	ed->AddedLength += len;
+
+	size_t start;
+	size_t i = sg_editor_find(ed, pos, &start);
+	SgPiece piece = { SG_PIECE_ADDED, added, len };
+	if(pos == start)
 	{
-		_sg_tb_position = sg_min(_sg_tb_position, _sg_tb_selection);
-		_sg_tb_selection = _sg_tb_position;
+		/* Typing extends the piece that was added last */
+		SgPiece *prev = i ? &ed->Pieces[i - 1] : NULL;
+		if(prev && prev->Source == SG_PIECE_ADDED &&
+			prev->Start + prev->Length == added)
+		{
+			start -= prev->Length;
+			prev->Length += len;
+			--i;
+		}
+		else
+		{
+			sg_editor_pieces_open(ed, i, 1);
+			ed->Pieces[i] = piece;
+		}
 	}
-	else if(_sg_tb_position > 0)
+	else
 	{
-		--_sg_tb_position;
-		_sg_tb_selection = _sg_tb_position;
+		size_t offset = pos - start;
+		sg_editor_pieces_open(ed, i + 1, 2);
+		SgPiece *p = &ed->Pieces[i];
+		p[2] = p[0];
+		p[2].Start += offset;
+		p[2].Length -= offset;
+		p[0].Length = offset;
+		p[1] = piece;
 	}
+
+	sg_editor_lines_insert(ed, pos, text, len);
+	ed->Length += len;
+
+	/* Pieces before i did not move */
+	ed->CachePiece = i;
+	ed->CacheStart = start;
 }
 
-static void sg_textbox_select_left(void)
+static void sg_editor_delete(SgEditor *ed, size_t pos, size_t count)
 {
-	if(_sg_tb_position > 0)
+	sg_editor_lines_delete(ed, pos, count);
+	ed->Length -= count;
+	while(count)
 	{
-		--_sg_tb_position;
+		size_t start;
+		size_t i = sg_editor_find(ed, pos, &start);
+		SgPiece *p = &ed->Pieces[i];
+		size_t offset = pos - start;
+		size_t n = sg_min_size(count, p->Length - offset);
+		if(n == p->Length)
+		{
+			memmove(p, p + 1, (ed->PieceCount - i - 1) * sizeof(SgPiece));
+			--ed->PieceCount;
+		}
+		else if(offset == 0)
+		{
+			p->Start += n;
+			p->Length -= n;
+		}
+		else if(offset + n == p->Length)
+		{
+			p->Length -= n;
+		}
+		else
+		{
+			sg_editor_pieces_open(ed, i + 1, 1);
+			p = &ed->Pieces[i];
+			p[1] = p[0];
+			p[1].Start += offset + n;
+			p[1].Length -= offset + n;
+			p[0].Length = offset;
+		}
+
+		count -= n;
+		ed->CachePiece = i;
+		ed->CacheStart = start;
 	}
 }
 
-static void sg_textbox_right(SgStringBuffer *sb)
-{
-	if(_sg_tb_selection != _sg_tb_position)
+void sg_editor_init(SgEditor *ed, const char *text, size_t length)
+{
+	memset(ed, 0, sizeof(*ed));
+	ed->Original = sg_malloc(length + 1);
+	memcpy(ed->Original, text, length);
+	ed->LineCount = 1;
+	ed->LineCapacity = 64;
+	ed->Lines = sg_malloc(ed->LineCapacity * sizeof(size_t));
+	ed->Lines[0] = 0;
+	ed->LineGap = 1;
+	sg_editor_lines_insert(ed, 0, text, length);
+	ed->Length = length;
+	if(length)
 	{
-		_sg_tb_position = sg_max(_sg_tb_position, _sg_tb_selection);
-		_sg_tb_selection = _sg_tb_position;
-	}
-	else if(_sg_tb_position < (int)sb->length)
-	{
-		++_sg_tb_position;
-		_sg_tb_selection = _sg_tb_position;
+		SgPiece piece = { SG_PIECE_ORIGINAL, 0, length };
+		sg_editor_pieces_open(ed, 0, 1);
+		ed->Pieces[0] = piece;
 	}
 }
 
-static void sg_textbox_select_right(SgStringBuffer *sb)
+void sg_editor_free(SgEditor *ed)
+{
+	sg_free(ed->Original);
+	sg_free(ed->Added);
+	sg_free(ed->Pieces);
+	sg_free(ed->Lines);
+	sg_free(ed->Anchors);
+	memset(ed, 0, sizeof(*ed));
+}
+
+size_t sg_editor_length(const SgEditor *ed)
+{
+	return ed->Length;
+}
+
+size_t sg_editor_line_count(const SgEditor *ed)
 {
-	if(_sg_tb_position < (int)sb->length)
+	return ed->LineCount;
+}
+
+size_t sg_editor_read(SgEditor *ed, size_t pos, char *buf, size_t len)
+{
+	size_t done = 0;
+	while(done < len && pos < ed->Length)
 	{
-		++_sg_tb_position;
+		size_t start;
+		size_t i = sg_editor_find(ed, pos, &start);
+		const SgPiece *p = &ed->Pieces[i];
+		size_t n = sg_min_size(len - done, p->Length - (pos - start));
+		memcpy(buf + done, sg_piece_text(ed, p) + pos - start, n);
+		done += n;
+		pos += n;
 	}
+
+	return done;
 }
 
-static void sg_textbox_home(void)
+static size_t sg_editor_edit_length(void *data)
 {
-	_sg_tb_selection = 0;
-	_sg_tb_position = 0;
+	return ((SgEditor *)data)->Length;
 }
 
-static void sg_textbox_select_home(void)
+static char sg_editor_edit_at(void *data, size_t index)
 {
-	_sg_tb_position = 0;
+	return sg_editor_char(data, index);
 }
 
-static void sg_textbox_end(SgStringBuffer *sb)
+static SgRect sg_editor_glyph(SgEditor *ed, size_t pos, size_t *next)
 {
-	_sg_tb_position = sb->length;
-	_sg_tb_selection = _sg_tb_position;
+	return sg_text_glyph(sg_editor_edit_at, ed, ed->Length, pos, next);
 }
 
-static void sg_textbox_select_end(SgStringBuffer *sb)
+/* Start of the character before pos */
+static size_t sg_editor_prev(SgEditor *ed, size_t pos)
 {
-	_sg_tb_position = sb->length;
+	return sg_text_char_start(sg_editor_edit_at, ed, ed->Length, pos - 1);
 }
 
-static void sg_textbox_select_all(SgStringBuffer *sb)
+#define SG_EDITOR_NO_LINE ((size_t)-1)
+#define SG_EDITOR_NO_POS  ((size_t)-1)
+
+static void sg_editor_anchors_reset(SgEditor *ed)
 {
-	_sg_tb_selection = 0;
-	_sg_tb_position = sb->length;
+	ed->Caret.Line = SG_EDITOR_NO_LINE;
+	for(size_t i = 0; i < ed->AnchorCount; ++i)
+	{
+		ed->Anchors[i].Line = SG_EDITOR_NO_LINE;
+	}
 }
 
-int sg_textbox_event_key(SgStringBuffer *sb, uint32_t key, uint32_t chr)
+/* One anchor per visible line, indexed by the line number */
+static void sg_editor_anchors_resize(SgEditor *ed, size_t count)
 {
-	uint32_t nomods = key & 0xFF;
-	if(key == SDL_SCANCODE_HOME)
+	if(ed->AnchorCount != count)
 	{
-		sg_textbox_home();
+		ed->Anchors = sg_realloc(ed->Anchors, count * sizeof(SgEditorAnchor));
+		ed->AnchorCount = count;
+		sg_editor_anchors_reset(ed);
 	}
-	else if(key == (SDL_SCANCODE_HOME | MOD_SHIFT))
+}
+
+static SgEditorAnchor *sg_editor_line_anchor(SgEditor *ed, size_t line)
+{
+	return &ed->Anchors[line % ed->AnchorCount];
+}
+
+/* Restarts a at the beginning of line unless it is already on it */
+static void sg_editor_anchor_line(SgEditor *ed, SgEditorAnchor *a, size_t line)
+{
+	if(ed->AnchorAtlas != _sg_fontatlas)
 	{
-		sg_textbox_select_home();
+		ed->AnchorAtlas = _sg_fontatlas;
+		sg_editor_anchors_reset(ed);
 	}
-	else if(key == SDL_SCANCODE_END)
+
+	if(a->Line != line)
 	{
-		sg_textbox_end(sb);
+		a->Line = line;
+		a->Pos = sg_editor_line_start(ed, line);
+		a->X = 0;
 	}
-	else if(key == (SDL_SCANCODE_END | MOD_SHIFT))
+}
+
+/* Width of the text from the start of its line up to pos,
+	walking from where the anchor was left */
+static int sg_editor_column_x(SgEditor *ed, SgEditorAnchor *a, size_t pos)
+{
+	sg_editor_anchor_line(ed, a, sg_editor_line_of(ed, pos));
+	while(a->Pos < pos)
 	{
-		sg_textbox_select_end(sb);
+		size_t next;
+		int w = sg_editor_glyph(ed, a->Pos, &next).w;
+		if(next > pos)
+		{
+			break;
+		}
+
+		a->X += w;
+		a->Pos = next;
 	}
-	else if(key == SDL_SCANCODE_LEFT)
+
+	while(a->Pos > pos)
 	{
-		sg_textbox_left();
+		size_t next;
+		a->Pos = sg_editor_prev(ed, a->Pos);
+		a->X -= sg_editor_glyph(ed, a->Pos, &next).w;
 	}
-	else if(key == (SDL_SCANCODE_LEFT | MOD_SHIFT))
+
+	return a->X;
+}
+
+/* First character of line whose right edge, or center, is right of x */
+static size_t sg_editor_seek(SgEditor *ed, SgEditorAnchor *a, size_t line,
+	int x, bool center)
+{
+	sg_editor_anchor_line(ed, a, line);
+	size_t start = sg_editor_line_start(ed, line);
+	size_t end = sg_editor_line_end(ed, line);
+	while(a->Pos > start)
 	{
-		sg_textbox_select_left();
+		size_t next;
+		size_t prev = sg_editor_prev(ed, a->Pos);
+		int w = sg_editor_glyph(ed, prev, &next).w;
+		if(x >= a->X - w + (center ? w / 2 : w))
+		{
+			break;
+		}
+
+		a->Pos = prev;
+		a->X -= w;
 	}
-	else if(key == SDL_SCANCODE_RIGHT)
+
+	while(a->Pos < end)
 	{
-		sg_textbox_right(sb);
+		size_t next;
+		int w = sg_editor_glyph(ed, a->Pos, &next).w;
+		if(x < a->X + (center ? w / 2 : w))
+		{
+			break;
+		}
+
+		a->Pos = next;
+		a->X += w;
 	}
-	else if(key == (SDL_SCANCODE_RIGHT | MOD_SHIFT))
+
+	return a->Pos;
+}
+
+/* Anchors before index stay valid. The caret anchor is moved back
+	to index if that is on its line, as edits happen at the caret. */
+static void sg_editor_anchors_edit(SgEditor *ed, size_t index)
+{
+	SgEditorAnchor *caret = &ed->Caret;
+	if(caret->Line != SG_EDITOR_NO_LINE && caret->Pos > index)
 	{
-		sg_textbox_select_right(sb);
+		if(index >= sg_editor_line_start(ed, caret->Line))
+		{
+			sg_editor_column_x(ed, caret, index);
+		}
+		else
+		{
+			caret->Line = SG_EDITOR_NO_LINE;
+		}
 	}
-	else if(nomods == SDL_SCANCODE_BACKSPACE)
+
+	for(size_t i = 0; i < ed->AnchorCount; ++i)
 	{
-		sg_textbox_backspace(sb);
+		if(ed->Anchors[i].Pos > index)
+		{
+			ed->Anchors[i].Line = SG_EDITOR_NO_LINE;
+		}
 	}
-	else if(nomods == SDL_SCANCODE_DELETE)
+}
+
+static size_t sg_editor_edit_replace(void *data, size_t index, size_t count,
+	const void *elems, size_t new_count)
+{
+	SgEditor *ed = data;
+	sg_editor_anchors_edit(ed, index);
+	ed->PreferredPos = SG_EDITOR_NO_POS;
+	if(count)
 	{
-		sg_textbox_delete(sb);
+		sg_editor_delete(ed, index, count);
 	}
-	else if(key == (SDL_SCANCODE_A | MOD_CTRL))
+
+	if(new_count)
 	{
-		sg_textbox_select_all(sb);
+		sg_editor_insert(ed, index, elems, new_count);
 	}
-	else if(key == (SDL_SCANCODE_C | MOD_CTRL))
+
+	++ed->Version;
+	return new_count;
+}
+
+/* x is relative to the start of the lines, y to the top of the first
+	visible line */
+static size_t sg_editor_click(SgEditor *ed, int x, int y, int line_h)
+{
+	int row = (y < 0) ? -1 - (-y - 1) / line_h : y / line_h;
+	if(row < 0 && (size_t)-row > ed->ScrollY)
 	{
-		sg_textbox_copy(sb);
+		return 0;
 	}
-	else if(key == (SDL_SCANCODE_X | MOD_CTRL))
+
+	size_t line = (row < 0) ? ed->ScrollY - (size_t)-row : ed->ScrollY + row;
+	if(line >= ed->LineCount)
 	{
-		sg_textbox_cut(sb);
+		return ed->Length;
 	}
-	else if(key == (SDL_SCANCODE_V | MOD_CTRL))
+
+	ed->PreferredPos = SG_EDITOR_NO_POS;
+	return sg_editor_seek(ed, sg_editor_line_anchor(ed, line), line, x, true);
+}
+
+/* Moves by lines at the pixel column the caret had before the first
+	of a run of Up and Down presses, not at its byte column */
+static size_t sg_editor_edit_vertical(void *data, size_t pos, int lines)
+{
+	SgEditor *ed = data;
+	if(pos != ed->PreferredPos)
 	{
-		sg_textbox_paste(sb);
+		ed->PreferredX = sg_editor_column_x(ed, &ed->Caret, pos);
 	}
-	else if(nomods == SDL_SCANCODE_RETURN)
+
+	size_t line = sg_editor_line_of(ed, pos);
+	if(lines < 0)
 	{
-		return '\n';
+		line = ((size_t)-lines > line) ? 0 : line - (size_t)-lines;
 	}
-	else if(isprint(chr))
+	else
 	{
-		sg_textbox_char(sb, chr);
+		line = sg_min_size(line + lines, ed->LineCount - 1);
 	}
 
-	return 0;
+	ed->PreferredPos = sg_editor_seek(ed, &ed->Caret, line, ed->PreferredX, true);
+	return ed->PreferredPos;
 }
 
-int sg_textbox_key_events(SgStringBuffer *sb)
+static void sg_editor_follow_caret(SgEditor *ed, int w, int lines)
 {
-	int result = 0;
-	for(int i = 0; i < _sg_keys_top; ++i)
+	size_t line = sg_editor_line_of(ed, ed->Position);
+	if(line < ed->ScrollY)
 	{
-		int key = _sg_keys[i];
-		int chr = sg_key_to_codepoint(key);
-		int ret = sg_textbox_event_key(sb, key, chr);
-		if(result != '\n')
-		{
-			result = ret;
-		}
+		ed->ScrollY = line;
+	}
+	else if(line >= ed->ScrollY + lines)
+	{
+		ed->ScrollY = line - lines + 1;
 	}
 
-	return result;
+	int caret = sg_editor_column_x(ed, &ed->Caret, ed->Position);
+	if(caret < ed->ScrollX)
+	{
+		ed->ScrollX = caret;
+	}
+	else if(caret + sg_theme->Cursor.w > ed->ScrollX + w)
+	{
+		ed->ScrollX = caret + sg_theme->Cursor.w - w;
+	}
 }
 
-bool sg_shift_down(void)
+/* Only emits the characters of the line that are within the clip rectangle */
+static void sg_editor_render_line(SgEditor *ed, size_t line, SgPoint p, SgRect clip,
+	size_t sel_start, size_t sel_end, SgColor color)
 {
-	return sg_is_key_down(SDL_SCANCODE_LSHIFT) ||
-		sg_is_key_down(SDL_SCANCODE_RSHIFT);
-}
+	int line_h = _sg_fontatlas->FontHeight;
+	int right = clip.x + clip.w;
+	size_t end = sg_editor_line_end(ed, line);
+	SgEditorAnchor *a = sg_editor_line_anchor(ed, line);
+	size_t i = sg_editor_seek(ed, a, line, clip.x - p.x, false);
+	for(p.x += a->X; i < end && p.x < right;)
+	{
+		bool sel = i >= sel_start && i < sel_end;
+		SgRect glyph = sg_editor_glyph(ed, i, &i);
+		if(sel)
+		{
+			sg_fill_rect(sg_rect(p.x, p.y, glyph.w, line_h), sg_theme->SelectionColor);
+		}
 
-bool sg_char_stop(int c)
-{
-	return c == ' ' || (ispunct(c) && c != '_');
+		p.x += sg_render_glyph(p, glyph, sel ? sg_theme->SelectionTextColor : color);
+	}
 }
 
-int sg_textbox(SgRect d, SgStringBuffer *sb)
+int sg_editor(SgRect d, SgEditor *ed)
 {
-	int result = 0;
+	sg_zone_begin("sg_editor");
+	sg_widget_begin();
 	int index;
 	bool selected = sg_selected(d, &index, &_sg_selected);
-	SgColor text_color = sg_theme->TextboxTextColor[index];
+	int border = sg_theme->TextboxBorderThickness[index];
+	int pad = sg_theme->TextboxPaddingX;
+	int line_h = _sg_fontatlas->FontHeight;
+	SgRect inner = sg_rect(d.x + pad, d.y + pad, d.w - 2 * pad, d.h - 2 * pad);
+	int lines = sg_max(inner.h / line_h, 1);
+	uint32_t version = ed->Version;
+	sg_editor_anchors_resize(ed, lines + 1);
+
+	SgTextEdit te =
+	{
+		.Data = ed,
+		.Length = sg_editor_edit_length,
+		.At = sg_editor_edit_at,
+		.Replace = sg_editor_edit_replace,
+		.Position = &ed->Position,
+		.Selection = &ed->Selection,
+		.Multiline = true,
+		.PageLines = lines,
+		.Vertical = sg_editor_edit_vertical
+	};
+
+	if(sg_rect_contains_mouse(d))
+	{
+		ed->ScrollY = sg_scroll_wheel(ed->ScrollY);
+	}
 
 	if(selected)
 	{
-		if(sg_rect_contains_mouse(d))
+		SgPoint m = sg_mouse_position();
+		int x = m.x - inner.x + ed->ScrollX;
+		int y = m.y - inner.y;
+		bool follow = false;
+		if(sg_triple_click && sg_rect_contains_mouse(d))
 		{
-			if(sg_triple_click)
-			{
-				_sg_tb_position = sb->length;
-				_sg_tb_selection = 0;
-				_sg_tb_multi_clicked = true;
-			}
-			else if(sg_double_click)
-			{
-				_sg_tb_position = sg_textbox_click(sb, sg_mouse_position().x, d.x);
-
-				for(; _sg_tb_position < (int)sb->length && !sg_char_stop(sb->buffer[_sg_tb_position]);
-					++_sg_tb_position)
-				{
-				}
+			sg_text_select_all(&te);
+			_sg_tb_multi_clicked = true;
+		}
+		else if(sg_double_click && sg_rect_contains_mouse(d))
+		{
+			ed->Position = sg_editor_click(ed, x, y, line_h);
+			sg_text_select_word(&te);
+			_sg_tb_multi_clicked = true;
+		}
+		else if(sg_is_mouse_button_pressed(SG_BUTTON_LEFT) && !sg_shift_down())
+		{
+			ed->Position = sg_editor_click(ed, x, y, line_h);
+			ed->Selection = ed->Position;
+			follow = true;
+		}
+		else if(sg_is_mouse_button_down(SG_BUTTON_LEFT) && !_sg_tb_multi_clicked)
+		{
+			ed->Position = sg_editor_click(ed, x, y, line_h);
+			follow = true;
+		}
 
-				for(_sg_tb_selection = _sg_tb_position;
-					_sg_tb_selection > 0 && !sg_char_stop(sb->buffer[_sg_tb_selection - 1]);
-					--_sg_tb_selection)
-				{
-				}
+		if(_sg_keys_top > 0 || sg_is_mouse_button_pressed(SG_BUTTON_LEFT))
+		{
+			_sg_tb_blink_start = SDL_GetTicks();
+		}
 
-				_sg_tb_multi_clicked = true;
-			}
-			else
-			{
-				if(sg_is_mouse_button_pressed(SG_BUTTON_LEFT) && !sg_shift_down())
-				{
-					_sg_tb_position = sg_textbox_click(sb, sg_mouse_position().x, d.x);
-					_sg_tb_selection = _sg_tb_position;
-				}
-				else if(sg_is_mouse_button_down(SG_BUTTON_LEFT) && !_sg_tb_multi_clicked)
-				{
-					_sg_tb_position = sg_textbox_click(sb, sg_mouse_position().x, d.x);
-				}
-			}
+		if(_sg_keys_top > 0)
+		{
+			sg_text_key_events(&te);
+			follow = true;
 		}
 
-		result = sg_textbox_key_events(sb);
+		if(follow)
+		{
+			sg_editor_follow_caret(ed, inner.w, lines);
+		}
 	}
 
+	ed->ScrollY = sg_min_size(ed->ScrollY, ed->LineCount - 1);
+
 	sg_box(d, index, sg_theme->TextboxInnerColor,
 		sg_theme->TextboxBorderColor, sg_theme->TextboxBorderThickness);
 
-	int text_y = d.y + d.h / 2 - _sg_fontatlas->FontHeight / 2;
+	SgRect clip = sg_rect(d.x + border, d.y + border,
+		d.w - 2 * border, d.h - 2 * border);
+	sg_push_clip(clip);
 
-	if(_sg_tb_selection == _sg_tb_position || !selected)
+	size_t sel_start = 0, sel_end = 0;
+	if(selected)
 	{
-		sg_render_string_len(
-			sg_point(d.x + sg_theme->TextboxPaddingX, text_y),
-			sb->buffer, sb->length,
-			text_color);
+		sel_start = sg_min_size(ed->Position, ed->Selection);
+		sel_end = sg_max_size(ed->Position, ed->Selection);
 	}
-	else
-	{
-		int sel_start = sg_min(_sg_tb_selection, _sg_tb_position);
-		int sel_len = sg_max(_sg_tb_selection, _sg_tb_position) - sel_start;
-
-		sg_render_string_len(
-			sg_point(d.x + sg_theme->TextboxPaddingX, text_y),
-			sb->buffer, sel_start,
-			text_color);
-
-		int sel_x = sg_string_width_len(sb->buffer, sel_start);
-
-		sg_fill_rect(sg_rect(
-			d.x + sg_theme->TextboxPaddingX + sel_x,
-			text_y + sg_theme->Cursor.y,
-			sg_string_width_len(sb->buffer + sel_start, sel_len),
-			_sg_fontatlas->FontHeight + sg_theme->Cursor.h),
-			sg_theme->SelectionColor);
-
-		sg_render_string_len(
-			sg_point(d.x + sg_theme->TextboxPaddingX + sel_x, text_y),
-			sb->buffer + sel_start, sel_len,
-			sg_theme->SelectionTextColor);
 
-		sg_render_string_len(
-			sg_point(d.x + sg_theme->TextboxPaddingX +
-				sg_string_width_len(sb->buffer, sel_start + sel_len),
-				text_y),
-			sb->buffer + sel_start + sel_len,
-			sb->length - sel_start - sel_len,
-			text_color);
+	/* Only the visible lines are drawn, plus a partially visible last one */
+	SgColor color = sg_theme->TextboxTextColor[index];
+	size_t last = sg_min_size(ed->LineCount, ed->ScrollY + lines + 1);
+	for(size_t line = ed->ScrollY; line < last; ++line)
+	{
+		SgPoint p = sg_point(inner.x - ed->ScrollX,
+			inner.y + (line - ed->ScrollY) * line_h);
+		sg_editor_render_line(ed, line, p, clip, sel_start, sel_end, color);
 	}
 
-	if(selected)
+	size_t caret_line = sg_editor_line_of(ed, ed->Position);
+	if(selected && sg_textbox_cursor_visible() &&
+		caret_line >= ed->ScrollY && caret_line < last)
 	{
-		sg_fill_rect(sg_rect(d.x + sg_theme->TextboxPaddingX +
-			sg_string_width_len(sb->buffer, _sg_tb_position) + sg_theme->Cursor.x,
-			text_y + sg_theme->Cursor.y,
+		int line = caret_line - ed->ScrollY;
+		sg_fill_rect(sg_rect(
+			inner.x - ed->ScrollX + sg_editor_column_x(ed, &ed->Caret, ed->Position) +
+				sg_theme->Cursor.x,
+			inner.y + line * line_h + sg_theme->Cursor.y,
 			sg_theme->Cursor.w,
-			_sg_fontatlas->FontHeight + sg_theme->Cursor.h),
+			line_h + sg_theme->Cursor.h),
 			sg_theme->CursorColor);
 	}
 
-	return result;
+	sg_pop_clip();
+	sg_widget_end();
+	sg_zone_end();
+	return ed->Version != version;
 }
 
 /* ========================================================================== */